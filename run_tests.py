@@ -1,3 +1,4 @@
+import filecmp
 import subprocess
 
 # Instructions: run with "python3 run_tests.py"
@@ -8,7 +9,8 @@ INPUTFILES = [
   # "nb-2-close"    ,
   "nb-10"         ,
   # "nb-100"        ,
-  # "nb-100000"     
+  # "nb-100000"     ,
+  # "nb-3d-100"     , # 3D (octree): first line "N 3"
 ]
 
 PROCESSES = [ 
@@ -23,8 +25,48 @@ THETAS = [
 ]
 DT_TIMESTEP = 0.005
 NUM_TESTS = 1
+# Steps between progress reports (steps/s, ETA, load skew) on stderr (0: none)
+HEARTBEAT_INTERVAL = 100
+# Reproducible mode (-R): also check that the output files with each number of
+# processes are bitwise identical to the output with 1 process, for each
+# engine, on 2D and 3D inputs
+CHECK_REPRODUCIBLE = True
+REPRODUCIBLE_INPUTFILES = [ "nb-10", "nb-3d-100" ]
+REPRODUCIBLE_ENGINES = [
+  [ "-e", "tree" ],
+  [ "-e", "direct" ],
+  [ "-e", "tree", "-m" ],       # node shared memory
+  [ "-e", "auto", "-n", "50" ], # direct below 50 particles, tree above
+]
+# Ensemble mode: run all (input, theta) jobs in one mpirun with this many
+# processes, in groups of ENSEMBLE_GROUP_SIZE per job (0: one mpirun per job)
+ENSEMBLE_PROCESSES = 0
+ENSEMBLE_GROUP_SIZE = 1
+
+if ENSEMBLE_PROCESSES > 0:
+    manifest = "output/mpi/ensemble.txt"
+    with open(manifest, "w") as f:
+        for filename in INPUTFILES:
+            for theta in THETAS:
+                f.write("-i input/{}.txt -o output/mpi/{}-{}-t{}.txt "
+                        "-t {}\n".format(filename, filename, STEPS, theta,
+                                         theta))
+    for program in PROGRAMS:
+        subprocess.call([
+          "mpirun",
+            "-np", str(ENSEMBLE_PROCESSES),
+          "bin/{}".format(program),
+            "-J", manifest,
+            "-g", str(ENSEMBLE_GROUP_SIZE),
+            "-s", str(STEPS),
+            "-d", str(DT_TIMESTEP),
+            "-H", str(HEARTBEAT_INTERVAL)
+        ])
 
-for program in PROGRAMS:
+# Separate runs of each program (unless replaced by the ensemble run)
+run_single = ENSEMBLE_PROCESSES == 0
+
+for program in (PROGRAMS if run_single else []):
     for filename in INPUTFILES:
         for n_processes in PROCESSES:
             for theta in THETAS:
@@ -41,7 +83,36 @@ for program in PROGRAMS:
                         # "-V", # visualization is not used
                         "-s", str(STEPS),
                         "-t", str(theta),
-                        "-d", str(DT_TIMESTEP)
+                        "-d", str(DT_TIMESTEP),
+                        "-H", str(HEARTBEAT_INTERVAL)
                     ])
                     # print(' ', end='', flush=True) # Python 3
                 # print('', end='\n', flush=True) # Python 3
+
+if CHECK_REPRODUCIBLE:
+    for program in PROGRAMS:
+        for filename in REPRODUCIBLE_INPUTFILES:
+            for engine in REPRODUCIBLE_ENGINES:
+                for theta in THETAS:
+                    outputs = []
+                    for n_processes in [1] + [p for p in PROCESSES if p != 1]:
+                        output = "output/mpi/{}-{}-np{}-R{}.txt".format(
+                            filename, STEPS, n_processes, "".join(engine))
+                        subprocess.call([
+                          "mpirun",
+                            "-np", str(n_processes),
+                          "bin/{}".format(program),
+                            "-i", "input/{}.txt".format(filename),
+                            "-o", output,
+                            "-s", str(STEPS),
+                            "-t", str(theta),
+                            "-d", str(DT_TIMESTEP),
+                            "-R"
+                        ] + engine, stdout=subprocess.DEVNULL)
+                        outputs.append((n_processes, output))
+                    for n_processes, output in outputs[1:]:
+                        same = filecmp.cmp(outputs[0][1], output,
+                                           shallow=False)
+                        print("{}-{} -R {}: 1 vs {} processes: {}".format(
+                            filename, STEPS, " ".join(engine), n_processes,
+                            "identical" if same else "DIFFERENT"))
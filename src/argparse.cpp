@@ -1,4 +1,5 @@
 #include <argparse.h>
+#include "kernels.h"
 
 // For testing and debugging
 void print_opts(struct options_t* opts) {
@@ -13,6 +14,29 @@ void print_opts(struct options_t* opts) {
   std::cout << "\t-t: " << opts->theta         << std::endl;
   std::cout << "\t-d: " << opts->dt            << std::endl;
   std::cout << "\t-V: " << opts->visualization << std::endl;
+  std::cout << "\t-e: " << (int)opts->engine   << std::endl;
+  std::cout << "\t-n: " << opts->direct_threshold << std::endl;
+  std::cout << "\t-m: " << opts->shared_memory << std::endl;
+  std::cout << "\t-D: " << 
+    (opts->diagnosticsfilename ? std::string(opts->diagnosticsfilename) 
+                               : "nullptr")
+    << std::endl;
+  std::cout << "\t-k: " << opts->diagnostics_interval << std::endl;
+  std::cout << "\t-A: " << opts->error_target  << std::endl;
+  std::cout << "\t-a: " << opts->adaptive_eta  << std::endl;
+  std::cout << "\t-P: " << opts->profile       << std::endl;
+  std::cout << "\t-J: " << 
+    (opts->manifestfilename ? std::string(opts->manifestfilename) : "nullptr")
+    << std::endl;
+  std::cout << "\t-g: " << opts->group_size    << std::endl;
+  std::cout << "\t-F: " << (int)opts->force_law << std::endl;
+  std::cout << "\t-S: " << opts->softening     << std::endl;
+  std::cout << "\t-c: " << opts->cutoff_radius << std::endl;
+  std::cout << "\t-w: " << opts->walk_group_size << std::endl;
+  std::cout << "\t-r: " << opts->reorder_interval << std::endl;
+  std::cout << "\t-R: " << opts->reproducible  << std::endl;
+  std::cout << "\t-H: " << opts->heartbeat_interval << std::endl;
+  std::cout << "\t-L: " << opts->max_lost_fraction << std::endl;
 }
 
 void set_default_opts(struct options_t* opts) {
@@ -23,6 +47,24 @@ void set_default_opts(struct options_t* opts) {
   opts->theta = -1;
   opts->dt = 0.005; // specified default
   opts->visualization = false;
+  opts->engine = Engine::Auto;
+  opts->direct_threshold = 512;
+  opts->shared_memory = false;
+  opts->diagnosticsfilename = nullptr;
+  opts->diagnostics_interval = 10;
+  opts->error_target = 0;
+  opts->adaptive_eta = 0;
+  opts->profile = false;
+  opts->manifestfilename = nullptr;
+  opts->group_size = 1;
+  opts->force_law = ForceLaw::Clamp;
+  opts->softening = r_limit;
+  opts->cutoff_radius = 1;
+  opts->walk_group_size = 16;
+  opts->reorder_interval = 10;
+  opts->reproducible = false;
+  opts->heartbeat_interval = 0;
+  opts->max_lost_fraction = 1;
 }
 
 bool contains_undefined_opts(struct options_t* opts) {
@@ -50,6 +92,9 @@ std::string get_undefined_opts_string(struct options_t* opts) {
   return result.str();
 }
 
+static void parse_opts(int argc, char** argv, struct options_t* opts,
+                       const char* optstring);
+
 void get_opts(int argc, char** argv, struct options_t* opts) {
   // print_opts(opts);
 
@@ -60,6 +105,25 @@ void get_opts(int argc, char** argv, struct options_t* opts) {
     std::cout << "\t-s <steps>"             << std::endl;
     std::cout << "\t-t <theta>"             << std::endl;
     std::cout << "\t-V [use visualization]" << std::endl;
+    std::cout << "\t-e <auto|tree|direct>" << std::endl;
+    std::cout << "\t-n <direct threshold>" << std::endl;
+    std::cout << "\t-m [use node shared memory]" << std::endl;
+    std::cout << "\t-D <diagnosticsfilename>" << std::endl;
+    std::cout << "\t-k <diagnostics interval>" << std::endl;
+    std::cout << "\t-A <autotune error target>" << std::endl;
+    std::cout << "\t-a <adaptive timestep eta>" << std::endl;
+    std::cout << "\t-P [print timing & memory profile]" << std::endl;
+    std::cout << "\t-J <job manifest> (ensemble mode)" << std::endl;
+    std::cout << "\t-g <processes per job>" << std::endl;
+    std::cout << "\t-F <clamp|plummer|spline|cutoff>" << std::endl;
+    std::cout << "\t-S <softening length>" << std::endl;
+    std::cout << "\t-c <cutoff radius>" << std::endl;
+    std::cout << "\t-w <particles per tree walk>" << std::endl;
+    std::cout << "\t-r <steps between reorders>" << std::endl;
+    std::cout << "\t-R [bitwise reproducible for any process count]"
+              << std::endl;
+    std::cout << "\t-H <steps between progress reports>" << std::endl;
+    std::cout << "\t-L <lost particle fraction to abort at>" << std::endl;
     exit(EXIT_SUCCESS);
   }
 
@@ -67,10 +131,33 @@ void get_opts(int argc, char** argv, struct options_t* opts) {
   set_default_opts(opts);
   //print_opts(opts);
 
+  parse_opts(argc, argv, opts, "i:o:s:t:d:Ve:n:mD:k:A:a:PJ:g:F:S:c:w:r:RH:L:");
+  // std::cout << "We made it out of the while loop." << std::endl;
+  //print_opts(opts);
+
+  // In ensemble mode, the required options are checked for each job
+  if (opts->manifestfilename == nullptr && contains_undefined_opts(opts)) {
+    std::cout << "Error: these options have missing or invalid values: " 
+              <<  get_undefined_opts_string(opts) << std::endl;
+    exit(EXIT_FAILURE);
+  }
+}
+
+bool get_job_opts(int argc, char** argv, struct options_t* opts) {
+  // A job can't be an ensemble itself: no -J & -g
+  parse_opts(argc, argv, opts, "i:o:s:t:d:Ve:n:mD:k:A:a:PF:S:c:w:r:RH:L:");
+  return !contains_undefined_opts(opts);
+}
+
+// Parses the options in argv (allowed by optstring) into opts
+static void parse_opts(int argc, char** argv, struct options_t* opts,
+                       const char* optstring) {
+  // Restart scanning (argv may be parsed more than once, for each job)
+  optind = 0;
   int c = 0;
   // char* optarg;  // stores string following option character
   // int optopt;    // stores unrecognized option character
-  while((c = getopt(argc, argv, "i:o:s:t:d:V")) != -1) {
+  while((c = getopt(argc, argv, optstring)) != -1) {
     // Debugging
     // print_opts(opts);
     // std::cout << "c: " << (char)c << std::endl;
@@ -105,18 +192,100 @@ void get_opts(int argc, char** argv, struct options_t* opts) {
       case 'V':
         opts->visualization = true;
         break;
+      case 'e':
+        if (std::string(optarg) == "auto") {
+          opts->engine = Engine::Auto;
+        } else if (std::string(optarg) == "tree") {
+          opts->engine = Engine::Tree;
+        } else if (std::string(optarg) == "direct") {
+          opts->engine = Engine::Direct;
+        } else {
+          std::cout << "Error: unknown engine " << optarg << ".\n";
+          exit(EXIT_FAILURE);
+        }
+        break;
+      case 'n':
+        opts->direct_threshold = atoi(optarg);
+        break;
+      case 'm':
+        opts->shared_memory = true;
+        break;
+      case 'D':
+        opts->diagnosticsfilename = optarg;
+        break;
+      case 'k':
+        opts->diagnostics_interval = atoi(optarg);
+        break;
+      case 'A':
+        opts->error_target = strtod(optarg, NULL);
+        break;
+      case 'a':
+        opts->adaptive_eta = strtod(optarg, NULL);
+        break;
+      case 'P':
+        opts->profile = true;
+        break;
+      case 'J':
+        opts->manifestfilename = optarg;
+        break;
+      case 'g':
+        opts->group_size = atoi(optarg);
+        if (opts->group_size < 1) {
+          std::cout << "Error: processes per job must be at least 1.\n";
+          exit(EXIT_FAILURE);
+        }
+        break;
+      case 'F':
+        if (std::string(optarg) == "clamp") {
+          opts->force_law = ForceLaw::Clamp;
+        } else if (std::string(optarg) == "plummer") {
+          opts->force_law = ForceLaw::Plummer;
+        } else if (std::string(optarg) == "spline") {
+          opts->force_law = ForceLaw::Spline;
+        } else if (std::string(optarg) == "cutoff") {
+          opts->force_law = ForceLaw::Cutoff;
+        } else {
+          std::cout << "Error: unknown force law " << optarg << ".\n";
+          exit(EXIT_FAILURE);
+        }
+        break;
+      case 'S':
+        opts->softening = strtod(optarg, NULL);
+        if (opts->softening <= 0) {
+          std::cout << "Error: softening length must be positive.\n";
+          exit(EXIT_FAILURE);
+        }
+        break;
+      case 'c':
+        opts->cutoff_radius = strtod(optarg, NULL);
+        if (opts->cutoff_radius <= 0) {
+          std::cout << "Error: cutoff radius must be positive.\n";
+          exit(EXIT_FAILURE);
+        }
+        break;
+      case 'w':
+        opts->walk_group_size = atoi(optarg);
+        if (opts->walk_group_size < 1) {
+          std::cout << "Error: particles per tree walk must be at least 1.\n";
+          exit(EXIT_FAILURE);
+        }
+        break;
+      case 'r':
+        opts->reorder_interval = atoi(optarg);
+        break;
+      case 'R':
+        opts->reproducible = true;
+        break;
+      case 'H':
+        opts->heartbeat_interval = atoi(optarg);
+        break;
+      case 'L':
+        opts->max_lost_fraction = strtod(optarg, NULL);
+        break;
       default:
         std::cout << "Error: unknown option or missing argument.\n";
         exit(EXIT_FAILURE);
         break;
     }
   }
-  // std::cout << "We made it out of the while loop." << std::endl;
-  //print_opts(opts);
-
-  if (contains_undefined_opts(opts)) {
-    std::cout << "Error: these options have missing or invalid values: " 
-              <<  get_undefined_opts_string(opts) << std::endl;
-    exit(EXIT_FAILURE);
-  }
 }
\ No newline at end of file
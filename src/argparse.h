@@ -6,6 +6,21 @@
 #include <sstream>
 #include <vector>
 
+// Force calculation engines
+enum class Engine {
+  Auto,    // direct if the number of particles is below the threshold
+  Tree,    // Barnes-Hut quadtree, approximated using theta
+  Direct   // exact O(N^2) direct summation
+};
+
+// Force laws (softening of the gravitational force, see kernels.h)
+enum class ForceLaw {
+  Clamp,   // distance clamped to the softening length
+  Plummer, // Plummer softening
+  Spline,  // cubic spline softening (Newtonian beyond 2.8 softening lengths)
+  Cutoff   // clamp, and no force beyond the cutoff radius
+};
+
 struct options_t {
   char* inputfilename;    // -i: input filename
   char* outputfilename;   // -o: output filename
@@ -19,6 +34,47 @@ struct options_t {
   bool visualization;     // -V: (OPTIONAL) flag for visualization window
                           //     false -> no visualization (default)
                           //     true  -> use visualization
+  Engine engine;          // -e: (OPTIONAL) engine: auto (default), tree, direct
+  int direct_threshold;   // -n: (OPTIONAL) auto uses the direct engine for 
+                          //     fewer than this many particles (default 512)
+  bool shared_memory;     // -m: (OPTIONAL) flag to share the particles & the
+                          //     quadtree among processes on the same node
+  char* diagnosticsfilename; // -D: (OPTIONAL) CSV file for energy & momentum
+                             //     diagnostics (none if not given)
+  int diagnostics_interval;  // -k: (OPTIONAL) steps between diagnostics
+                             //     (default 10)
+  double error_target;    // -A: (OPTIONAL) autotune theta: use the largest 
+                          //     theta with RMS relative force error below
+                          //     this target (default 0: use -t; ignored
+                          //     with a warning by the direct engine)
+  double adaptive_eta;    // -a: (OPTIONAL) adaptive timestep with accuracy
+                          //     parameter eta, at most dt (default 0: off)
+  bool profile;           // -P: (OPTIONAL) flag to print per-phase timing,
+                          //     communication overlap statistics and the
+                          //     memory used per data structure
+  char* manifestfilename; // -J: (OPTIONAL) ensemble mode: run the jobs of
+                          //     this manifest (one line of options per job,
+                          //     -i, -o, -s, -t are then given per job)
+  int group_size;         // -g: (OPTIONAL) processes per job in ensemble
+                          //     mode (default 1)
+  ForceLaw force_law;     // -F: (OPTIONAL) force law: clamp (default),
+                          //     plummer, spline, cutoff
+  double softening;       // -S: (OPTIONAL) softening length (default 0.03)
+  double cutoff_radius;   // -c: (OPTIONAL) cutoff radius of the cutoff
+                          //     force law (default 1)
+  int walk_group_size;    // -w: (OPTIONAL) particles per shared tree walk
+                          //     (default 16; 1: a walk per particle)
+  int reorder_interval;   // -r: (OPTIONAL) steps between sorting particles
+                          //     along the Morton curve (default 10; 0: never)
+  bool reproducible;      // -R: (OPTIONAL) flag for results that are bitwise
+                          //     identical for any number of processes (fixed
+                          //     summation order; may be slower)
+  int heartbeat_interval; // -H: (OPTIONAL) steps between progress reports on
+                          //     stderr (default 0: none)
+  double max_lost_fraction; // -L: (OPTIONAL) abort if more than this fraction
+                            //     of the particles are lost, checked at each
+                            //     progress report, or every 10 steps without
+                            //     -H (default 1: never)
 };
 
 void print_opts(struct options_t* opts);
@@ -29,4 +85,9 @@ bool contains_undefined_opts(struct options_t* opts);
 
 void get_opts(int argc, char** argv, struct options_t* opts);
 
+// Parses the options of one job of an ensemble manifest (argv[0] is ignored)
+// on top of opts, which holds the defaults (the command line options).
+// Returns false if required options are missing.
+bool get_job_opts(int argc, char** argv, struct options_t* opts);
+
 #endif
\ No newline at end of file
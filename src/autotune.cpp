@@ -0,0 +1,192 @@
+#include "autotune.h"
+#include "exactsum.h"
+#include "physics.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+// Maximum number of particles sampled for the force error
+constexpr int NUM_SAMPLES = 256;
+// Number of times the forces are calculated (timed) for each theta
+constexpr int NUM_REPETITIONS = 2;
+
+// Error & cost of calculating forces with one theta
+struct Calibration {
+  double theta;
+  double error;    // RMS relative force error over the samples
+  double seconds;  // Time to calculate forces for a slice (max over procs)
+};
+
+// Calculates forces for the slice with theta, and the error on the samples
+template <int D, typename Kernel>
+static Calibration calibrate(const Particle<D>* particles, int N,
+                             int start, int end,
+                             const Tree<D>& tree, GroupWalk<D, Kernel>& walk,
+                             double theta,
+                             const std::vector<int>& samples,
+                             const std::vector<Vec<double, D>>& exact,
+                             std::vector<Vec<double, D>>& forces,
+                             MPI_Comm comm) {
+  // Take the fastest of a few repetitions, to reduce timing noise
+  double seconds = 0;
+  for (int k = 0; k < NUM_REPETITIONS; ++k) {
+    double t0 = MPI_Wtime();
+    walk.calc_net_forces(particles, N, start, end, tree.nodes,
+                         tree.num_nodes, theta, forces.data());
+    double t = MPI_Wtime() - t0;
+    seconds = (k == 0 ? t : std::min(seconds, t));
+  }
+  // Sum of squared relative errors & number of samples (exact, so every
+  // division of the particles selects the same theta)
+  ExactSum sums[2];
+  for (size_t k = 0; k < samples.size(); ++k) {
+    double f2 = len2(exact[k]);
+    if (f2 == 0) continue;
+    sums[0] += len2(forces[samples[k] - start] - exact[k]) / f2;
+    sums[1] += 1;
+  }
+  ExactSum::allreduce(sums, 2, comm);
+  MPI_Allreduce(MPI_IN_PLACE, &seconds, 1, MPI_DOUBLE, MPI_MAX, comm);
+  double n = sums[1].value();
+  double error = (n > 0 ? std::sqrt(sums[0].value()/n) : 0);
+  return {theta, error, seconds};
+}
+
+template <int D, typename Kernel>
+double autotune_theta(Particle<D>* particles, int N_particles,
+                      int start, int end, const Region<double, D>& region,
+                      GroupWalk<D, Kernel>& walk, double error_target,
+                      double theta_user, MPI_Comm comm, double* bytes) {
+  int rank; MPI_Comm_rank(comm, &rank);
+
+  // Tree of the current particles. Particles outside the region are
+  // skipped rather than marked lost by insert, so particles are only read
+  // (they may be shared with other processes).
+  Tree<D> tree(region);
+  auto lost = [&](const Particle<D>& p) {
+    return p.mass == -1 || !isContained(p, region);
+  };
+  for (int i = 0; i < N_particles; ++i) {
+    if (!lost(particles[i])) { tree.insert(particles[i]); }
+  }
+
+  // Sample every stride-th particle (of those in this process' slice), and
+  // calculate its exact force by direct summation over all particles.
+  int stride = std::max(1, N_particles / NUM_SAMPLES);
+  std::vector<int> samples;
+  std::vector<Vec<double, D>> exact;
+  for (int i = start; i < end; ++i) {
+    const Particle<D>& p = particles[i];
+    if (i % stride != 0 || lost(p)) continue;
+    Vec<double, D> f = {};
+    for (int j = 0; j < N_particles; ++j) {
+      const Particle<D>& q = particles[j];
+      if (j == i || lost(q)) continue;
+      f += gravity(p.mass, q.mass, p.position, q.position, walk.kernel);
+    }
+    samples.push_back(i);
+    exact.push_back(f);
+  }
+
+  // Calibrate candidates theta = 0.1, 0.2, ..., 1.5 and the user's theta
+  std::vector<Vec<double, D>> forces(end - start);
+  std::vector<Calibration> candidates;
+  for (int k = 1; k <= 15; ++k) {
+    candidates.push_back(calibrate(particles, N_particles, start, end, tree,
+                                   walk, 0.1*k, samples, exact, forces,
+                                   comm));
+  }
+  Calibration user = calibrate(particles, N_particles, start, end, tree, walk,
+                               theta_user, samples, exact, forces, comm);
+
+  // Largest theta meeting the target, or else the most accurate one
+  const Calibration* best = nullptr;
+  for (const Calibration& c : candidates) {
+    if (c.error <= error_target) { best = &c; }
+  }
+  bool met = (best != nullptr);
+  if (!met) {
+    best = &*std::min_element(candidates.begin(), candidates.end(),
+        [](const Calibration& a, const Calibration& b) {
+          return a.error < b.error;
+        });
+  }
+
+  if (rank == 0) {
+    printf("Autotune (target RMS relative force error %g):\n", error_target);
+    printf("\ttheta\terror\t\tms/step (forces)\n");
+    for (const Calibration& c : candidates) {
+      printf("\t%.1f\t%e\t%f\n", c.theta, c.error, 1e3*c.seconds);
+    }
+    if (!met) {
+      printf("\tno theta meets the target, using the most accurate\n");
+    }
+    printf("\tselected theta = %.1f (error %e), "
+           "%.2fx force throughput of theta = %g (error %e)\n",
+           best->theta, best->error,
+           best->seconds > 0 ? user.seconds/best->seconds : 1.0,
+           theta_user, user.error);
+  }
+  *bytes = tree.bytes() + (double)samples.capacity()*sizeof(int) +
+           (double)(exact.capacity() + forces.capacity())*
+           sizeof(Vec<double, D>);
+  return best->theta;
+}
+
+template <int D>
+double adaptive_timestep(const Particle<D>* slice,
+                         const Vec<double, D>* forces, int count,
+                         double eta, double softening, double dt_max,
+                         MPI_Comm comm) {
+  // Maximum squared acceleration (lost particles have no force)
+  double a2_max = 0;
+  for (int i = 0; i < count; ++i) {
+    if (slice[i].mass == -1) continue;
+    a2_max = std::max(a2_max, len2(forces[i]/slice[i].mass));
+  }
+  MPI_Allreduce(MPI_IN_PLACE, &a2_max, 1, MPI_DOUBLE, MPI_MAX, comm);
+  if (a2_max == 0) return dt_max;
+  double dt = eta * std::sqrt(softening / std::sqrt(a2_max));
+  return std::min(dt, dt_max);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Instantiations for 2D & 3D, and each kernel
+////////////////////////////////////////////////////////////////////////////////
+template double autotune_theta(Particle<2>*, int, int, int,
+                               const Region<double, 2>&,
+                               GroupWalk<2, ClampKernel>&,
+                               double, double, MPI_Comm, double*);
+template double autotune_theta(Particle<2>*, int, int, int,
+                               const Region<double, 2>&,
+                               GroupWalk<2, PlummerKernel>&,
+                               double, double, MPI_Comm, double*);
+template double autotune_theta(Particle<2>*, int, int, int,
+                               const Region<double, 2>&,
+                               GroupWalk<2, SplineKernel>&,
+                               double, double, MPI_Comm, double*);
+template double autotune_theta(Particle<2>*, int, int, int,
+                               const Region<double, 2>&,
+                               GroupWalk<2, CutoffKernel>&,
+                               double, double, MPI_Comm, double*);
+template double autotune_theta(Particle<3>*, int, int, int,
+                               const Region<double, 3>&,
+                               GroupWalk<3, ClampKernel>&,
+                               double, double, MPI_Comm, double*);
+template double autotune_theta(Particle<3>*, int, int, int,
+                               const Region<double, 3>&,
+                               GroupWalk<3, PlummerKernel>&,
+                               double, double, MPI_Comm, double*);
+template double autotune_theta(Particle<3>*, int, int, int,
+                               const Region<double, 3>&,
+                               GroupWalk<3, SplineKernel>&,
+                               double, double, MPI_Comm, double*);
+template double autotune_theta(Particle<3>*, int, int, int,
+                               const Region<double, 3>&,
+                               GroupWalk<3, CutoffKernel>&,
+                               double, double, MPI_Comm, double*);
+template double adaptive_timestep(const Particle<2>*, const Vec<double, 2>*,
+                                  int, double, double, double, MPI_Comm);
+template double adaptive_timestep(const Particle<3>*, const Vec<double, 3>*,
+                                  int, double, double, double, MPI_Comm);
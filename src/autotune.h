@@ -0,0 +1,50 @@
+#ifndef _AUTOTUNE_H
+#define _AUTOTUNE_H
+
+#include "mpi.h"
+
+#include "particle.h"
+#include "quadtree.h"
+#include "vector.h"
+#include "walk.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// Automatic choice of theta
+////////////////////////////////////////////////////////////////////////////////
+//
+// Runs short calibration steps on the current particles (all processes must
+// have all N particles): for each candidate theta, every process calculates
+// the forces for its slice [start, end) as in a step, timing it, and the
+// forces on a sample of particles are compared to exact forces from direct
+// summation. The error of a theta is the RMS over the samples of the
+// relative force error |f - f_exact|/|f_exact|. Forces are calculated as
+// the solver does, with walk (and its force law, see kernels.h).
+//
+// Returns the largest candidate theta whose error is at most error_target
+// (or the most accurate candidate if none is), and prints a report on
+// process 0 of comm, with the speedup of the force calculation over
+// theta_user. Sets *bytes to the size of its temporary buffers (its own
+// tree, samples & forces), freed on return. Collective over comm.
+template <int D, typename Kernel>
+double autotune_theta(Particle<D>* particles, int N_particles,
+                      int start, int end, const Region<double, D>& region,
+                      GroupWalk<D, Kernel>& walk, double error_target,
+                      double theta_user, MPI_Comm comm, double* bytes);
+
+////////////////////////////////////////////////////////////////////////////////
+// Adaptive timestep
+////////////////////////////////////////////////////////////////////////////////
+//
+// Courant-style criterion: a particle should not move by more than about
+// the force softening length eps (-S) due to its acceleration in one step,
+//   dt = eta * sqrt(eps / max|a|)
+// with the maximum over all particles of comm (the count particles of the
+// slice with their forces on each process), and at most dt_max.
+// [Synchronization point: MPI_Allreduce is blocking]
+template <int D>
+double adaptive_timestep(const Particle<D>* slice,
+                         const Vec<double, D>* forces, int count,
+                         double eta, double softening, double dt_max,
+                         MPI_Comm comm);
+
+#endif // _AUTOTUNE_H
@@ -0,0 +1,107 @@
+#include "diagnostics.h"
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+
+////////////////////////////////////////////////////////////////////////////////
+// Diagnostics
+////////////////////////////////////////////////////////////////////////////////
+
+// Adds the kinetic energy, momentum & angular momentum of p to d
+template <int D>
+static void add_motion(const Particle<D>& p, PartialDiagnostics<D>& d) {
+  const Vec<double, D>& r = p.position;
+  const Vec<double, D>& v = p.velocity;
+  d.kinetic() += 0.5*p.mass*len2(v);
+  ExactSum* momentum = d.momentum();
+  for (int i = 0; i < D; ++i) {
+    momentum[i] += p.mass*v[i];
+  }
+  // r x v: only the z component is nonzero in 2D
+  ExactSum* angular = d.angular_momentum();
+  angular[Diagnostics<D>::NUM_ANGULAR - 1] += p.mass*(r[0]*v[1] - r[1]*v[0]);
+  if constexpr (D == 3) {
+    angular[0] += p.mass*(r[1]*v[2] - r[2]*v[1]);
+    angular[1] += p.mass*(r[2]*v[0] - r[0]*v[2]);
+  }
+  d.num_particles() += 1;
+}
+
+template <int D>
+PartialDiagnostics<D> calc_diagnostics(const Particle<D>* slice, int count,
+                                       const double* potentials) {
+  PartialDiagnostics<D> d = {};
+  for (int i = 0; i < count; ++i) {
+    // Ignore lost particles
+    if (slice[i].mass == -1) continue;
+    add_motion(slice[i], d);
+    d.potential() += 0.5*potentials[i];
+  }
+  return d;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// DiagnosticsLog
+////////////////////////////////////////////////////////////////////////////////
+template <int D>
+DiagnosticsLog<D>::DiagnosticsLog(MPI_Comm c, char* filename, int k)
+    : comm(c),
+      enabled(filename != nullptr),
+      interval(std::max(k, 1)),
+      initial_total(0),
+      has_initial(false) {
+  MPI_Comm_rank(comm, &rank);
+  if (enabled && rank == 0) {
+    ofs.open(filename, std::ios_base::trunc);
+    if (!ofs.is_open()) {
+      perror("Unable to open file");
+      exit(EXIT_FAILURE);
+    }
+    ofs << "step,time,kinetic,potential,total,energy_drift,";
+    if (D == 2) {
+      ofs << "momentum_x,momentum_y,angular_momentum,";
+    } else {
+      ofs << "momentum_x,momentum_y,momentum_z,"
+          << "angular_momentum_x,angular_momentum_y,angular_momentum_z,";
+    }
+    ofs << "particles\n";
+    ofs << std::setprecision(10);
+  }
+}
+
+template <int D>
+void DiagnosticsLog<D>::record(int step, double time,
+                               const PartialDiagnostics<D>& local) {
+  constexpr int count = Diagnostics<D>::NUM_SUMS;
+  PartialDiagnostics<D> sums;
+  ExactSum::reduce(local.sums.data(), sums.sums.data(), count, 0, comm);
+  if (rank != 0) return;
+  Diagnostics<D> d;
+  for (int k = 0; k < count; ++k) { d.sums[k] = sums.sums[k].value(); }
+  double total = d.kinetic() + d.potential();
+  if (!has_initial) {
+    initial_total = total;
+    has_initial = true;
+  }
+  double drift = (initial_total != 0 ?
+                  (total - initial_total)/std::abs(initial_total) : 0);
+  ofs << step << "," << time << ","
+      << d.kinetic() << "," << d.potential() << "," << total << ","
+      << drift << ",";
+  for (int i = 0; i < D; ++i) { ofs << d.momentum()[i] << ","; }
+  for (int i = 0; i < Diagnostics<D>::NUM_ANGULAR; ++i) {
+    ofs << d.angular_momentum()[i] << ",";
+  }
+  ofs << (long)d.num_particles() << "\n";
+  ofs.flush();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Instantiations for 2D & 3D
+////////////////////////////////////////////////////////////////////////////////
+template PartialDiagnostics<2> calc_diagnostics(const Particle<2>*, int,
+                                                const double*);
+template PartialDiagnostics<3> calc_diagnostics(const Particle<3>*, int,
+                                                const double*);
+template struct DiagnosticsLog<2>;
+template struct DiagnosticsLog<3>;
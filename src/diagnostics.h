@@ -0,0 +1,76 @@
+#ifndef _DIAGNOSTICS_H
+#define _DIAGNOSTICS_H
+
+#include "mpi.h"
+
+#include <array>
+#include <fstream>
+#include "exactsum.h"
+#include "particle.h"
+#include "quadtree.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// Conserved quantities (to monitor accuracy drift in-situ)
+////////////////////////////////////////////////////////////////////////////////
+// Sums over (a set of) particles. Lost particles are not counted.
+// Angular momentum has 1 component (z) in 2D, and 3 (x, y, z) in 3D.
+// The sums are stored in one array (to be reduced as a whole), and named by
+// the accessors.
+template <int D, typename T = double>
+struct Diagnostics {
+  static constexpr int NUM_ANGULAR = (D == 2 ? 1 : 3);
+  static constexpr int NUM_SUMS = 3 + D + NUM_ANGULAR;
+
+  std::array<T, NUM_SUMS> sums;
+
+  T& kinetic() { return sums[0]; }   // Sum of m*|v|^2/2
+  T& potential() { return sums[1]; } // Sum over pairs of potential energy
+  T* momentum() { return &sums[2]; } // Sum of m*v (D components)
+  // Sum of m*(r x v) (about the origin, NUM_ANGULAR components)
+  T* angular_momentum() { return &sums[2 + D]; }
+  // Number of particles (not lost)
+  T& num_particles() { return sums[2 + D + NUM_ANGULAR]; }
+};
+
+// The sums of one process, kept exact (see exactsum.h), so the totals don't
+// depend on how the particles are divided among processes
+template <int D>
+using PartialDiagnostics = Diagnostics<D, ExactSum>;
+
+// Diagnostics for the count particles of slice, given the potential energy
+// of each with all other particles (e.g. from direct summation, or
+// approximated with the tree).
+template <int D>
+PartialDiagnostics<D> calc_diagnostics(const Particle<D>* slice, int count,
+                                       const double* potentials);
+
+////////////////////////////////////////////////////////////////////////////////
+// DiagnosticsLog
+////////////////////////////////////////////////////////////////////////////////
+// Every interval steps, the processes' diagnostics are reduced to root, which
+// appends a row to a CSV file:
+//   step,time,kinetic,potential,total,energy_drift,
+//   momentum_x,momentum_y,angular_momentum,particles
+// where energy_drift = (total - total at first row)/|total at first row|.
+// In 3D, momentum has a momentum_z column too, and angular momentum is
+// angular_momentum_x,angular_momentum_y,angular_momentum_z.
+template <int D>
+struct DiagnosticsLog {
+  MPI_Comm comm;
+  int rank;
+  bool enabled;      // false if no filename was given: nothing is recorded
+  int interval;
+  std::ofstream ofs; // Open on root only
+  double initial_total;
+  bool has_initial;
+
+  DiagnosticsLog(MPI_Comm comm, char* filename, int interval);
+
+  // Whether diagnostics should be recorded for the state at this step
+  bool due(int step) const { return enabled && step % interval == 0; }
+  // Reduces the processes' diagnostics for the state at the given step and
+  // (simulated) time, and writes a row (collective)
+  void record(int step, double time, const PartialDiagnostics<D>& local);
+};
+
+#endif // _DIAGNOSTICS_H
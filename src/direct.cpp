@@ -0,0 +1,247 @@
+#include "direct.h"
+#include <algorithm>
+#include <cmath>
+
+////////////////////////////////////////////////////////////////////////////////
+// Kernels
+////////////////////////////////////////////////////////////////////////////////
+// Coordinates are named x, y, z; for D = 2 the z terms are constant 0 and
+// are removed by the compiler.
+
+// For each target i, adds sum_j m_j*g(d)*(r_j - r_i) over the n sources, with
+// g as in gravity(). A target coincident with a source (including itself)
+// has r_j - r_i = 0 (and g is finite), so it needs no special case.
+template <int D, typename Kernel>
+void accumulate_direct(const double* targets, int n_targets,
+                       int target_capacity, const double* block, int capacity,
+                       int n, const Kernel& kernel, double* acc) {
+  const int tc = target_capacity;
+  const double* x = block;
+  const double* y = block + capacity;
+  const double* z = block + 2*capacity; // (m for D = 2: unused)
+  const double* m = block + D*capacity;
+  for (int j_tile = 0; j_tile < n; j_tile += TILE_SOURCES) {
+    int j_end = std::min(j_tile + TILE_SOURCES, n);
+    for (int i = 0; i < n_targets; ++i) {
+      double xi = targets[i];
+      double yi = targets[tc + i];
+      double zi = (D == 3 ? targets[2*tc + i] : 0);
+      double sx = 0;
+      double sy = 0;
+      double sz = 0;
+      #pragma omp simd reduction(+:sx,sy,sz)
+      for (int j = j_tile; j < j_end; ++j) {
+        double dx = x[j] - xi;
+        double dy = y[j] - yi;
+        double dz = (D == 3 ? z[j] - zi : 0);
+        double w = m[j]*kernel.force(dx*dx + dy*dy + dz*dz);
+        sx += w*dx;
+        sy += w*dy;
+        sz += w*dz;
+      }
+      acc[i] += sx;
+      acc[tc + i] += sy;
+      if (D == 3) { acc[2*tc + i] += sz; }
+    }
+  }
+}
+
+// For each target i, adds sum_j m_j*phi(d) over the n sources.
+template <int D, typename Kernel>
+void accumulate_potential_direct(const double* targets, int n_targets,
+                                 const double* block, int capacity, int n,
+                                 const Kernel& kernel, double* u) {
+  const double* x = block;
+  const double* y = block + capacity;
+  const double* z = block + 2*capacity; // (m for D = 2: unused)
+  const double* m = block + D*capacity;
+  for (int j_tile = 0; j_tile < n; j_tile += TILE_SOURCES) {
+    int j_end = std::min(j_tile + TILE_SOURCES, n);
+    for (int i = 0; i < n_targets; ++i) {
+      double xi = targets[i];
+      double yi = targets[capacity + i];
+      double zi = (D == 3 ? targets[2*capacity + i] : 0);
+      double sum = 0;
+      #pragma omp simd reduction(+:sum)
+      for (int j = j_tile; j < j_end; ++j) {
+        double dx = x[j] - xi;
+        double dy = y[j] - yi;
+        double dz = (D == 3 ? z[j] - zi : 0);
+        sum += m[j]*kernel.potential(dx*dx + dy*dy + dz*dz);
+      }
+      u[i] += sum;
+    }
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// DirectSum
+////////////////////////////////////////////////////////////////////////////////
+template <int D, typename Kernel>
+DirectSum<D, Kernel>::DirectSum(MPI_Comm c, const std::vector<int>& sizes,
+                                const Kernel& k, bool o)
+    : comm(c),
+      kernel(k),
+      ordered(o),
+      slice_sizes(sizes),
+      t_wait(0) {
+  MPI_Comm_rank(comm, &rank);
+  MPI_Comm_size(comm, &size);
+  capacity = *std::max_element(slice_sizes.begin(), slice_sizes.end());
+  if (ordered) {
+    capacity = (capacity + TILE_SOURCES - 1) / TILE_SOURCES * TILE_SOURCES;
+  }
+  blocks[0].resize((D + 1)*capacity);
+  blocks[1].resize((D + 1)*capacity);
+  targets.resize(D*capacity);
+  acc.resize(D*capacity);
+}
+
+template <int D, typename Kernel>
+double DirectSum<D, Kernel>::bytes() const {
+  return (double)(blocks[0].capacity() + blocks[1].capacity() +
+                  targets.capacity() + acc.capacity())*sizeof(double);
+}
+
+template <int D, typename Kernel>
+void DirectSum<D, Kernel>::pack(const Particle<D>* slice, int count, 
+                                double* block) const {
+  for (int i = 0; i < count; ++i) {
+    for (int k = 0; k < D; ++k) {
+      block[k*capacity + i] = slice[i].position[k];
+    }
+    block[D*capacity + i] = (slice[i].mass == -1 ? 0 : slice[i].mass);
+  }
+}
+
+template <int D, typename Kernel>
+void DirectSum<D, Kernel>::pass_ring(Particle<D>* slice, int count,
+                                     const Region<double, D>& region,
+                                     bool potentials) {
+  // Particles outside the region are lost
+  for (int i = 0; i < count; ++i) {
+    if (!isContained(slice[i], region)) { slice[i].mass = -1; }
+    for (int k = 0; k < D; ++k) {
+      targets[k*capacity + i] = slice[i].position[k];
+      acc[k*capacity + i] = 0;
+    }
+  }
+  int cur = 0;
+  if (ordered) {
+    // Block r is broadcast by process r. The next block is received while
+    // computing on the current one.
+    MPI_Request request;
+    if (rank == 0) { pack(slice, count, blocks[cur].data()); }
+    MPI_Ibcast(blocks[cur].data(), (D + 1)*capacity, MPI_DOUBLE, 0, comm,
+               &request);
+    for (int owner = 0; owner < size; ++owner) {
+      double t0 = MPI_Wtime();
+      MPI_Wait(&request, MPI_STATUS_IGNORE);
+      t_wait += MPI_Wtime() - t0;
+      int next = owner + 1;
+      if (next < size) {
+        if (rank == next) { pack(slice, count, blocks[1 - cur].data()); }
+        MPI_Ibcast(blocks[1 - cur].data(), (D + 1)*capacity, MPI_DOUBLE,
+                   next, comm, &request);
+      }
+      accumulate(blocks[cur].data(), slice_sizes[owner], count, potentials);
+      cur = 1 - cur;
+    }
+    return;
+  }
+
+  // The first block is this process' own slice
+  pack(slice, count, blocks[cur].data());
+
+  int left = (rank - 1 + size) % size;
+  int right = (rank + 1) % size;
+  for (int k = 0; k < size; ++k) {
+    // Owner of the block held at round k
+    int owner = (rank - k + size) % size;
+    // Pass the block on to the right and receive the next one from the left
+    // while computing on it. (Reading a buffer being sent is allowed.)
+    MPI_Request requests[2];
+    bool passing = (k < size - 1);
+    if (passing) {
+      MPI_Irecv(blocks[1 - cur].data(), (D + 1)*capacity, MPI_DOUBLE, 
+                left, 0, comm, &requests[0]);
+      MPI_Isend(blocks[cur].data(), (D + 1)*capacity, MPI_DOUBLE, 
+                right, 0, comm, &requests[1]);
+    }
+    accumulate(blocks[cur].data(), slice_sizes[owner], count, potentials);
+    if (passing) {
+      double t0 = MPI_Wtime();
+      MPI_Waitall(2, requests, MPI_STATUSES_IGNORE);
+      t_wait += MPI_Wtime() - t0;
+    }
+    cur = 1 - cur;
+  }
+}
+
+template <int D, typename Kernel>
+void DirectSum<D, Kernel>::accumulate(const double* block, int n, int count,
+                                      bool potentials) {
+  if (potentials) {
+    accumulate_potential_direct<D>(targets.data(), count, block, capacity, n,
+                                   kernel, acc.data());
+  } else {
+    accumulate_direct<D>(targets.data(), count, capacity, block, capacity, n,
+                         kernel, acc.data());
+  }
+}
+
+template <int D, typename Kernel>
+void DirectSum<D, Kernel>::calc_net_forces(Particle<D>* slice, int count,
+                                           const Region<double, D>& region,
+                                           Vec<double, D>* forces) {
+  pass_ring(slice, count, region, false);
+  // Scale accelerations to forces. Lost particles receive no force.
+  for (int i = 0; i < count; ++i) {
+    double m = slice[i].mass;
+    for (int k = 0; k < D; ++k) {
+      forces[i][k] = (m == -1 ? 0 : G*m*acc[k*capacity + i]);
+    }
+  }
+}
+
+template <int D, typename Kernel>
+void DirectSum<D, Kernel>::calc_potentials(Particle<D>* slice, int count,
+                                           const Region<double, D>& region,
+                                           double* potentials) {
+  pass_ring(slice, count, region, true);
+  // Remove each particle's term with itself (d = 0) and scale by G*m_i.
+  // Lost particles have no potential energy.
+  double self = kernel.potential(0);
+  for (int i = 0; i < count; ++i) {
+    double m = slice[i].mass;
+    potentials[i] = (m == -1 ? 0 : G*m*(acc[i] - m*self));
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Instantiations for 2D & 3D, and each kernel
+////////////////////////////////////////////////////////////////////////////////
+template struct DirectSum<2, ClampKernel>;
+template struct DirectSum<2, PlummerKernel>;
+template struct DirectSum<2, SplineKernel>;
+template struct DirectSum<2, CutoffKernel>;
+template struct DirectSum<3, ClampKernel>;
+template struct DirectSum<3, PlummerKernel>;
+template struct DirectSum<3, SplineKernel>;
+template struct DirectSum<3, CutoffKernel>;
+template void accumulate_direct<2>(const double*, int, int, const double*,
+                                   int, int, const ClampKernel&, double*);
+template void accumulate_direct<2>(const double*, int, int, const double*,
+                                   int, int, const PlummerKernel&, double*);
+template void accumulate_direct<2>(const double*, int, int, const double*,
+                                   int, int, const SplineKernel&, double*);
+template void accumulate_direct<2>(const double*, int, int, const double*,
+                                   int, int, const CutoffKernel&, double*);
+template void accumulate_direct<3>(const double*, int, int, const double*,
+                                   int, int, const ClampKernel&, double*);
+template void accumulate_direct<3>(const double*, int, int, const double*,
+                                   int, int, const PlummerKernel&, double*);
+template void accumulate_direct<3>(const double*, int, int, const double*,
+                                   int, int, const SplineKernel&, double*);
+template void accumulate_direct<3>(const double*, int, int, const double*,
+                                   int, int, const CutoffKernel&, double*);
@@ -0,0 +1,110 @@
+#ifndef _DIRECT_H
+#define _DIRECT_H
+
+#include "mpi.h"
+
+#include <vector>
+#include "kernels.h"
+#include "particle.h"
+#include "quadtree.h"
+#include "vector.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// Direct summation (exact O(N^2) reference engine)
+////////////////////////////////////////////////////////////////////////////////
+//
+// Every process owns a slice of the particles. To compute the forces on its
+// slice, each process packs the slice into a block of source particles, and
+// the blocks are passed around the ring of processes (systolic scheme): at
+// each of the size rounds, a process adds the forces due to the block it
+// currently holds, while it already sends that block to the next process and
+// receives the next block from the previous process.
+// No process ever needs the full particles vector.
+//
+// The blocks are stored as a structure of arrays (x, y, (z,) m) so the inner
+// loop over sources is contiguous and vectorizes, and the loops are tiled so
+// a tile of sources stays in L1 cache while all targets in a tile use it.
+// The force law (see kernels.h) is inlined into the loops.
+//
+// In ordered mode (reproducible), the blocks are instead broadcast by their
+// owners in rank order, so every process sums them in the same, global
+// order. If the slices are whole tiles (see TILE_SOURCES), the tiles are
+// then the same for any number of processes, and so is every target's sum.
+template <int D, typename Kernel>
+struct DirectSum {
+  MPI_Comm comm;
+  Kernel kernel;
+  bool ordered;
+  int rank;
+  int size;
+  int capacity;  // Maximum number of particles in any slice (rounded up to
+                 // whole tiles if ordered, so the tiles' alignment is fixed)
+
+  // Two blocks of sources: one being computed on, one being received.
+  // Layout of each block: [x_0..x_cap-1 | y_0.. | (z_0.. |) m_0..m_cap-1]
+  std::vector<double> blocks[2];
+  // Sizes of every process' slice, to know the length of a received block.
+  std::vector<int> slice_sizes;
+  // Targets (local slice) positions and accumulated accelerations, with the
+  // same layout as blocks: [x_0..x_cap-1 | y_0.. | (z_0..)]
+  std::vector<double> targets;
+  std::vector<double> acc;
+
+  double t_wait;  // Time blocked waiting for ring communication
+
+  // Prepare buffers for slices of the given sizes (one per process in comm)
+  DirectSum(MPI_Comm comm, const std::vector<int>& slice_sizes,
+            const Kernel& kernel, bool ordered = false);
+
+  // Calculates the net force on each of the count particles of the local
+  // slice by direct summation over the particles of all slices in the ring.
+  // Writes forces[i] for i in [0, count).
+  // Particles outside the region are lost: their mass is set to -1 (as
+  // Tree::insert does), they receive no force and exert none.
+  void calc_net_forces(Particle<D>* slice, int count,
+                       const Region<double, D>& region,
+                       Vec<double, D>* forces);
+
+  // Calculates the potential energy of each particle of the local slice with
+  // all other particles (consistent with the force).
+  // Writes potentials[i] for i in [0, count).
+  void calc_potentials(Particle<D>* slice, int count,
+                       const Region<double, D>& region, double* potentials);
+
+  // Bytes allocated for the buffers
+  double bytes() const;
+
+  private:
+  // Packs the slice into the given block (lost particles get 0 mass)
+  void pack(const Particle<D>* slice, int count, double* block) const;
+  // Passes the blocks around the ring (or broadcasts them in rank order, if
+  // ordered), accumulating accelerations in acc or (if potentials is true)
+  // potentials per unit G*m_i in acc.
+  void pass_ring(Particle<D>* slice, int count, 
+                 const Region<double, D>& region, bool potentials);
+  // Adds the terms due to the n sources of block to the count targets
+  void accumulate(const double* block, int n, int count, bool potentials);
+};
+
+// Number of sources in a tile: 512 * (D+1) doubles = 12-16 KB, fits in L1
+constexpr int TILE_SOURCES = 512;
+
+// Adds the accelerations (per unit G, i.e. sum of m_j*g(d)*(r_j-r_i), with
+// g(d) = kernel.force(d^2)) due to n sources in block to the n_targets
+// targets. Targets, accelerations and block are laid out as in DirectSum:
+// targets & accelerations with target_capacity, block with capacity.
+template <int D, typename Kernel>
+void accumulate_direct(const double* targets, int n_targets,
+                       int target_capacity, const double* block, int capacity,
+                       int n, const Kernel& kernel, double* acc);
+
+// Adds the potentials (per unit G, i.e. sum of m_j*phi(d), with
+// phi(d) = kernel.potential(d^2)) due to n sources in block to the
+// n_targets targets. Sources at the same position as a target are included
+// (so the caller must remove a target's own term, m_i*phi(0)).
+template <int D, typename Kernel>
+void accumulate_potential_direct(const double* targets, int n_targets,
+                                 const double* block, int capacity, int n,
+                                 const Kernel& kernel, double* u);
+
+#endif // _DIRECT_H
@@ -0,0 +1,167 @@
+#include "ensemble.h"
+#include "io.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <numeric>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// A job of the manifest
+struct Job {
+  int line;         // Line number in the manifest (from 1)
+  options_t opts;   // Options (filenames point into the manifest text)
+};
+
+// Process 0 of comm reads the whole manifest and broadcasts its text
+// (null-terminated) to all processes.
+static std::vector<char> read_manifest(char* filename, MPI_Comm comm) {
+  int rank; MPI_Comm_rank(comm, &rank);
+  std::vector<char> text;
+  int length = 0;
+  if (rank == 0) {
+    std::ifstream ifs(filename);
+    if (!ifs.is_open()) {
+      perror("Unable to open file");
+      MPI_Abort(comm, EXIT_FAILURE);
+    }
+    std::stringstream ss;
+    ss << ifs.rdbuf();
+    std::string s = ss.str();
+    text.assign(s.begin(), s.end());
+    length = text.size();
+  }
+  MPI_Bcast(&length, 1, MPI_INT, 0, comm);
+  text.resize(length + 1, '\0');
+  MPI_Bcast(text.data(), length, MPI_CHAR, 0, comm);
+  return text;
+}
+
+// Splits the manifest text into jobs. The text is tokenized in place (like
+// argv, the options of the jobs point into it), so it must outlive the jobs.
+static std::vector<Job> parse_jobs(std::vector<char>& text,
+                                   const options_t& defaults, int rank) {
+  static char program[] = "nbody"; // argv[0] of every job
+  std::vector<Job> jobs;
+  char* line = text.data();
+  for (int number = 1; line != nullptr; ++number) {
+    char* next = strchr(line, '\n');
+    if (next != nullptr) { *next++ = '\0'; }
+
+    std::vector<char*> argv = {program};
+    char* save = nullptr;
+    for (char* token = strtok_r(line, " \t\r", &save); token != nullptr;
+         token = strtok_r(nullptr, " \t\r", &save)) {
+      argv.push_back(token);
+    }
+    line = next;
+    // Ignore empty lines & comments
+    if (argv.size() == 1 || argv[1][0] == '#') continue;
+
+    Job job = {number, defaults};
+    if (!get_job_opts(argv.size(), argv.data(), &job.opts)) {
+      if (rank == 0) {
+        printf("Error: job on line %d of the manifest needs -i, -o, -s "
+               "and -t (in the manifest or on the command line).\n", number);
+      }
+      MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+    }
+    jobs.push_back(job);
+  }
+  return jobs;
+}
+
+// Returns the order in which the jobs are handed out: decreasing estimated
+// cost (particles x steps), so that the small jobs come last.
+static std::vector<int> schedule(const std::vector<Job>& jobs, MPI_Comm comm) {
+  int rank; MPI_Comm_rank(comm, &rank);
+  std::vector<double> costs(jobs.size(), 0);
+  if (rank == 0) {
+    for (size_t j = 0; j < jobs.size(); ++j) {
+      costs[j] = (double)read_num_particles(jobs[j].opts.inputfilename) *
+                 std::max(jobs[j].opts.steps, 1);
+    }
+  }
+  MPI_Bcast(costs.data(), costs.size(), MPI_DOUBLE, 0, comm);
+  std::vector<int> order(jobs.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(),
+                   [&](int a, int b) { return costs[a] > costs[b]; });
+  return order;
+}
+
+void run_ensemble(const options_t& opts, Simulate simulate) {
+  int rank; MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  int size; MPI_Comm_size(MPI_COMM_WORLD, &size);
+  double t_start = MPI_Wtime();
+
+  std::vector<char> text = read_manifest(opts.manifestfilename,
+                                         MPI_COMM_WORLD);
+  std::vector<Job> jobs = parse_jobs(text, opts, rank);
+  std::vector<int> order = schedule(jobs, MPI_COMM_WORLD);
+  int num_jobs = jobs.size();
+
+  // Split processes into groups of group_size (the last group also gets
+  // the remaining processes)
+  int group_size = std::min(opts.group_size, size);
+  int num_groups = size / group_size;
+  int group = std::min(rank / group_size, num_groups - 1);
+  MPI_Comm group_comm;
+  MPI_Comm_split(MPI_COMM_WORLD, group, rank, &group_comm);
+  int group_rank; MPI_Comm_rank(group_comm, &group_rank);
+  int group_procs; MPI_Comm_size(group_comm, &group_procs);
+
+  // Shared scheduler: counter of the next job (in order) on process 0
+  int* counter = nullptr;
+  MPI_Win win;
+  MPI_Win_allocate(rank == 0 ? sizeof(int) : 0, sizeof(int), MPI_INFO_NULL,
+                   MPI_COMM_WORLD, &counter, &win);
+  MPI_Win_lock_all(MPI_MODE_NOCHECK, win);
+  if (rank == 0) {
+    *counter = 0;
+    MPI_Win_sync(win);
+  }
+  // [Synchronization point: the counter is initialized before any job]
+  MPI_Barrier(MPI_COMM_WORLD);
+
+  int jobs_run = 0;
+  while (true) {
+    // Process 0 of the group takes the next job, for the whole group
+    int next = 0;
+    if (group_rank == 0) {
+      const int one = 1;
+      MPI_Fetch_and_op(&one, &next, MPI_INT, 0, 0, MPI_SUM, win);
+      MPI_Win_flush(0, win);
+    }
+    MPI_Bcast(&next, 1, MPI_INT, 0, group_comm);
+    if (next >= num_jobs) break;
+
+    const Job& job = jobs[order[next]];
+    options_t job_opts = job.opts; // The simulation may change e.g. theta
+    double seconds = simulate(job_opts, group_comm);
+    jobs_run++;
+    if (group_rank == 0) {
+      printf("job %d (%s -> %s): %f s on group %d (%d processes)\n",
+             job.line, job.opts.inputfilename, job.opts.outputfilename,
+             seconds, group, group_procs);
+      fflush(stdout);
+    }
+  }
+
+  MPI_Win_unlock_all(win);
+  MPI_Win_free(&win);
+  MPI_Comm_free(&group_comm);
+
+  // How evenly the jobs were spread over the groups
+  int most_jobs = 0;
+  int fewest_jobs = 0;
+  MPI_Reduce(&jobs_run, &most_jobs, 1, MPI_INT, MPI_MAX, 0, MPI_COMM_WORLD);
+  MPI_Reduce(&jobs_run, &fewest_jobs, 1, MPI_INT, MPI_MIN, 0, MPI_COMM_WORLD);
+  if (rank == 0) {
+    printf("Ensemble: %d jobs on %d groups in %f s "
+           "(%d to %d jobs per group)\n", num_jobs, num_groups,
+           MPI_Wtime() - t_start, fewest_jobs, most_jobs);
+  }
+}
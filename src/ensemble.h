@@ -0,0 +1,35 @@
+#ifndef _ENSEMBLE_H
+#define _ENSEMBLE_H
+
+#include "mpi.h"
+
+#include "argparse.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// Ensemble mode: many independent simulations in one launch
+////////////////////////////////////////////////////////////////////////////////
+//
+// The job manifest (-J) has one job per line: the options of one simulation,
+// as on the command line, e.g.
+//   -i input/nb-100.txt -o output/nb-100-t0.5.txt -s 1000 -t 0.5
+// Options not given on a line default to those given on the command line.
+// Empty lines and lines starting with '#' are ignored.
+//
+// MPI_COMM_WORLD is split into groups of group_size (-g) processes (the last
+// group also gets the remaining processes), and each group runs one job at a
+// time. The jobs are handed out by a shared scheduler: a job counter in an
+// MPI window on process 0, which a group's process 0 increments atomically
+// (MPI_Fetch_and_op) when the group is free. So groups that get small jobs
+// take more of them, and no process waits for a static assignment.
+// Jobs are handed out in order of decreasing estimated cost (particles x
+// steps), so the small jobs fill in the gaps at the end.
+
+// Runs one simulation with the given options on the processes of comm, and
+// returns the elapsed seconds (on process 0 of comm).
+typedef double (*Simulate)(options_t& opts, MPI_Comm comm);
+
+// Runs all jobs of opts.manifestfilename with simulate. Collective over
+// MPI_COMM_WORLD.
+void run_ensemble(const options_t& opts, Simulate simulate);
+
+#endif // _ENSEMBLE_H
@@ -0,0 +1,126 @@
+#include "exactsum.h"
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+// Weight of digit 1 (digits are base 2^32)
+constexpr int64_t RADIX = (int64_t)1 << 32;
+// Additions between carry propagations: each adds less than 2^32 to a
+// digit, so digits stay far from overflowing
+constexpr int MAX_PENDING = 1 << 30;
+
+ExactSum::ExactSum() : digits(), pending(0), nonfinite(0) {}
+
+ExactSum& ExactSum::operator+=(double x) {
+  if (x == 0) return *this;
+  if (!std::isfinite(x)) {
+    nonfinite += x;
+    return *this;
+  }
+  // x = m * 2^(e - 53), with the integer mantissa |m| < 2^53
+  int e;
+  double f = std::frexp(x, &e);
+  int64_t m = (int64_t)std::ldexp(f, 53);
+  int position = e - 53 + BIAS;
+  int w = position / 32;
+  int s = position % 32;
+  // Split |m| * 2^s into 3 digits
+  uint64_t u = (m < 0 ? -m : m);
+  uint64_t rest = (s == 0 ? u >> 32 : u >> (32 - s));
+  int64_t d0 = (u << s) & (RADIX - 1);
+  int64_t d1 = rest & (RADIX - 1);
+  int64_t d2 = rest >> 32;
+  if (m < 0) {
+    d0 = -d0;
+    d1 = -d1;
+    d2 = -d2;
+  }
+  digits[w] += d0;
+  digits[w + 1] += d1;
+  digits[w + 2] += d2;
+  if (++pending == MAX_PENDING) { normalize(); }
+  return *this;
+}
+
+void ExactSum::normalize() {
+  for (int i = 0; i < NUM_DIGITS - 1; ++i) {
+    // Floor division, so the remainder is in [0, 2^32)
+    int64_t carry = digits[i] >> 32;
+    digits[i] -= carry * RADIX;
+    digits[i + 1] += carry;
+  }
+  pending = 0;
+}
+
+double ExactSum::value() const {
+  if (nonfinite != 0) return nonfinite;
+  // Convert the magnitude (all digits nonnegative), most significant first
+  ExactSum n = *this;
+  n.normalize();
+  bool negative = (n.digits[NUM_DIGITS - 1] < 0);
+  if (negative) {
+    for (int64_t& d : n.digits) { d = -d; }
+    n.normalize();
+  }
+  double v = 0;
+  for (int i = NUM_DIGITS - 1; i >= 0; --i) {
+    v += std::ldexp((double)n.digits[i], 32*i - BIAS);
+  }
+  return negative ? -v : v;
+}
+
+// Copies the normalized digits & nonfinite sums of count sums into arrays
+static void pack(const ExactSum* sums, int count, std::vector<int64_t>& digits,
+                 std::vector<double>& nonfinite) {
+  digits.resize(count*ExactSum::NUM_DIGITS);
+  nonfinite.resize(count);
+  for (int k = 0; k < count; ++k) {
+    ExactSum n = sums[k];
+    n.normalize();
+    std::copy(n.digits, n.digits + ExactSum::NUM_DIGITS,
+              &digits[k*ExactSum::NUM_DIGITS]);
+    nonfinite[k] = n.nonfinite;
+  }
+}
+
+static void unpack(const std::vector<int64_t>& digits,
+                   const std::vector<double>& nonfinite, ExactSum* sums,
+                   int count) {
+  for (int k = 0; k < count; ++k) {
+    std::copy(&digits[k*ExactSum::NUM_DIGITS],
+              &digits[(k + 1)*ExactSum::NUM_DIGITS], sums[k].digits);
+    sums[k].nonfinite = nonfinite[k];
+    sums[k].normalize();
+  }
+}
+
+// Normalized digits are below 2^32, so the integer sums of the processes'
+// digits are exact (and so is the sum of the nonfinite terms, which are
+// only 0, infinities or NaN)
+void ExactSum::reduce(const ExactSum* local, ExactSum* result, int count,
+                      int root, MPI_Comm comm) {
+  int rank; MPI_Comm_rank(comm, &rank);
+  std::vector<int64_t> digits;
+  std::vector<double> nonfinite;
+  pack(local, count, digits, nonfinite);
+  std::vector<int64_t> total_digits(rank == root ? digits.size() : 0);
+  std::vector<double> total_nonfinite(rank == root ? count : 0);
+  MPI_Reduce(digits.data(), total_digits.data(), digits.size(), MPI_INT64_T,
+             MPI_SUM, root, comm);
+  MPI_Reduce(nonfinite.data(), total_nonfinite.data(), count, MPI_DOUBLE,
+             MPI_SUM, root, comm);
+  if (rank == root) {
+    unpack(total_digits, total_nonfinite, result, count);
+  }
+}
+
+void ExactSum::allreduce(ExactSum* sums, int count, MPI_Comm comm) {
+  std::vector<int64_t> digits;
+  std::vector<double> nonfinite;
+  pack(sums, count, digits, nonfinite);
+  MPI_Allreduce(MPI_IN_PLACE, digits.data(), digits.size(), MPI_INT64_T,
+                MPI_SUM, comm);
+  MPI_Allreduce(MPI_IN_PLACE, nonfinite.data(), count, MPI_DOUBLE, MPI_SUM,
+                comm);
+  unpack(digits, nonfinite, sums, count);
+}
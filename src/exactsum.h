@@ -0,0 +1,49 @@
+#ifndef _EXACTSUM_H
+#define _EXACTSUM_H
+
+#include "mpi.h"
+
+#include <cstdint>
+
+////////////////////////////////////////////////////////////////////////////////
+// Exact sum of doubles
+////////////////////////////////////////////////////////////////////////////////
+//
+// Floating-point addition is not associative, so a sum over particles
+// depends on how they are divided among processes and in which order the
+// partial sums are combined. ExactSum accumulates doubles without rounding,
+// as a fixed-point number covering the whole range of doubles (in 32-bit
+// digits, each held in an int64_t so carries can be deferred), so the sum
+// is the same for any order of additions and reductions. It is only rounded
+// when converted by value() (to within about 1 ulp).
+//
+// Infinities & NaNs are summed separately (their sum is order-independent).
+struct ExactSum {
+  // Bit 0 of digit 0 has the weight 2^-BIAS (below the smallest subnormal
+  // mantissa bit, 2^-1074, so every double is a whole number of units)
+  static constexpr int BIAS = 1127;
+  // Enough digits for the largest double, with room for carries
+  static constexpr int NUM_DIGITS = 72;
+
+  int64_t digits[NUM_DIGITS];
+  int pending;      // Additions since the last carry propagation
+  double nonfinite; // Sum of the infinite & NaN terms
+
+  ExactSum();
+  ExactSum& operator+=(double x);
+  // The sum, rounded to a double
+  double value() const;
+
+  // Propagates carries: digits 0..NUM_DIGITS-2 in [0, 2^32), the last one
+  // holds the sign. The digits are then unique for a given sum.
+  void normalize();
+
+  // Sums the count sums of each process of comm into result (elementwise)
+  // on process root. Collective.
+  static void reduce(const ExactSum* local, ExactSum* result, int count,
+                     int root, MPI_Comm comm);
+  // As reduce, with the result on every process (in place). Collective.
+  static void allreduce(ExactSum* sums, int count, MPI_Comm comm);
+};
+
+#endif // _EXACTSUM_H
@@ -0,0 +1,18 @@
+#include "integrator.h"
+
+template <int D>
+int ConstantAccelerationIntegrator<D>::update(Particle<D>* slice,
+                                              const Vec<double, D>* forces,
+                                              int count, double dt) {
+  int blown_up = 0;
+  for (int i = 0; i < count; ++i) {
+    if (!slice[i].update(forces[i], dt)) { blown_up++; }
+  }
+  return blown_up;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Instantiations for 2D & 3D
+////////////////////////////////////////////////////////////////////////////////
+template struct ConstantAccelerationIntegrator<2>;
+template struct ConstantAccelerationIntegrator<3>;
@@ -0,0 +1,29 @@
+#ifndef _INTEGRATOR_H
+#define _INTEGRATOR_H
+
+#include "particle.h"
+#include "vector.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// Integrators: advance the particles of a slice by one step, given the net
+// force on each. Lost particles (m = -1) must be left unchanged.
+// update() returns the number of particles whose new position or velocity
+// is not finite (blown up), for the simulation to abort.
+////////////////////////////////////////////////////////////////////////////////
+template <int D>
+struct Integrator {
+  virtual ~Integrator() = default;
+
+  virtual int update(Particle<D>* slice, const Vec<double, D>* forces,
+                     int count, double dt) = 0;
+};
+
+// Constant acceleration over the step (Particle::update):
+//   r += v*dt + a*dt^2/2,  v += a*dt
+template <int D>
+struct ConstantAccelerationIntegrator : Integrator<D> {
+  int update(Particle<D>* slice, const Vec<double, D>* forces,
+             int count, double dt) override;
+};
+
+#endif // _INTEGRATOR_H
@@ -1,8 +1,10 @@
 #include "io.h"
 #include "particle.h"
 #include "vector.h"
+#include <algorithm>
 #include <iostream>
 #include <fstream>
+#include <numeric>
 #include <sstream>
 #include <vector>
 
@@ -23,64 +25,139 @@ int read_num_particles(char* inputfilename) {
   return num_particles;
 }
 
-// Reads the input file and returns vector of particles
-std::vector<Particle> read_file(char* inputfilename) {
+// Reads only the first line of the file: "N" (2D) or "N D".
+int read_dimension(char* inputfilename) {
   std::ifstream ifs(inputfilename);
   if (!ifs.is_open()) {
     perror("Unable to open file");
     exit(EXIT_FAILURE);
   }
+  std::string line;
+  std::getline(ifs, line);
+  std::stringstream ss(line);
+  int num_particles = 0;
+  int dimension = 2;
+  ss >> num_particles >> dimension;
+  if (dimension != 2 && dimension != 3) {
+    std::cerr << "Unsupported dimension " << dimension << " in "
+              << inputfilename << " (must be 2 or 3)" << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  return dimension;
+}
 
+// Reads the input file and returns vector of particles
+template <int D>
+std::vector<Particle<D>> read_file(char* inputfilename) {
+  ParticleReader<D> reader(inputfilename);
+  // Create a vector for all particles, and read them in one chunk
+  std::vector<Particle<D>> particles(reader.num_particles);
+  int count = reader.read(particles.data(), particles.size());
+  particles.resize(count);
+  return particles;
+}
+
+template <int D>
+ParticleReader<D>::ParticleReader(char* inputfilename)
+    : ifs(inputfilename),
+      num_particles(0) {
+  if (!ifs.is_open()) {
+    perror("Unable to open file");
+    exit(EXIT_FAILURE);
+  }
   // Get first line that contains the number of points
   std::string line;
   std::getline(ifs, line);
   std::stringstream ss(line);
-  int num_particles = 0;
   ss >> num_particles;
+}
 
-  // Create a vector with this capacity reserved
-  std::vector<Particle> particles;
-  particles.reserve(num_particles);
-
-  // Reuse line to read data for all particles
-  while(std::getline(ifs, line)) {
+template <int D>
+int ParticleReader<D>::read(Particle<D>* particles, int count) {
+  // Reuse line to read data for the particles
+  std::string line;
+  int n = 0;
+  while (n < count && std::getline(ifs, line)) {
     // Ignore empty lines
     if (line.empty()) { continue; }
     std::stringstream ss(line);
     // Each line contains ordered data:
-    Particle p; // uninitialized
+    Particle<D>& p = particles[n++];
     ss >> p.index;
-    ss >> p.position.x >> p.position.y;
+    for (int i = 0; i < D; ++i) { ss >> p.position[i]; }
     ss >> p.mass;
-    ss >> p.velocity.x >> p.velocity.y;
-    // Add to vector
-    particles.emplace_back(p);
+    for (int i = 0; i < D; ++i) { ss >> p.velocity[i]; }
   }
-  return particles;
+  return n;
+}
+
+template <int D>
+std::vector<int> index_order(const Particle<D>* particles, int N) {
+  std::vector<int> order(N);
+  std::iota(order.begin(), order.end(), 0);
+  std::sort(order.begin(), order.end(), [&](int a, int b) {
+    return particles[a].index < particles[b].index;
+  });
+  return order;
 }
 
 // Writes the final state of all particles to the output file.
 // The number of particles is printed on the first line,
 // Particle data is printed one per line, and matches the 
-// order in which it appeared in the input file.
-void write_file(const std::vector<Particle>& particles, char* outputfilename, bool sci_notation) {
-  // Overwrite the file's previous content
-  std::ofstream ofs(outputfilename, std::ios_base::trunc);
+// order in which it appeared in the input file (the order of the indices:
+// the simulation may have reordered the particles).
+template <int D>
+void write_file(const Particle<D>* particles, int N, char* outputfilename, bool sci_notation) {
+  ParticleWriter<D> writer(outputfilename, N, sci_notation);
+  // Restore the input order
+  std::vector<int> order = index_order(particles, N);
+  for (int i = 0; i < N; ++i) {
+    writer.write(&particles[order[i]], 1);
+  }
+}
+
+template <int D>
+ParticleWriter<D>::ParticleWriter(char* outputfilename, int N,
+                                  bool sci_notation)
+    // Overwrite the file's previous content
+    : ofs(outputfilename, std::ios_base::trunc) {
   if (!ofs.is_open()) {
     perror("Unable to open file");
     exit(EXIT_FAILURE);
   }
-  // Print number of particles on first line
-  ofs << particles.size() << '\n';
+  // Print number of particles (and dimension, unless 2D) on first line
+  ofs << N;
+  if (D != 2) { ofs << " " << D; }
+  ofs << '\n';
   // Switch to scientific notation
   if (sci_notation) {
     ofs.setf(std::ios_base::scientific);
   }
+}
+
+template <int D>
+void ParticleWriter<D>::write(const Particle<D>* particles, int count) {
   // Print particle index, position, mass, and velocity on each line
-  for (const Particle& particle : particles) {
-    ofs << particle.index << " "
-        << particle.position.x << " " << particle.position.y << " "
-        << particle.mass << " "
-        << particle.velocity.x << " " << particle.velocity.y << '\n';
+  for (int n = 0; n < count; ++n) {
+    const Particle<D>& particle = particles[n];
+    ofs << particle.index << " ";
+    for (int i = 0; i < D; ++i) { ofs << particle.position[i] << " "; }
+    ofs << particle.mass;
+    for (int i = 0; i < D; ++i) { ofs << " " << particle.velocity[i]; }
+    ofs << '\n';
   }
-}
\ No newline at end of file
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Instantiations for 2D & 3D
+////////////////////////////////////////////////////////////////////////////////
+template std::vector<Particle<2>> read_file<2>(char*);
+template std::vector<Particle<3>> read_file<3>(char*);
+template std::vector<int> index_order(const Particle<2>*, int);
+template std::vector<int> index_order(const Particle<3>*, int);
+template void write_file(const Particle<2>*, int, char*, bool);
+template void write_file(const Particle<3>*, int, char*, bool);
+template struct ParticleReader<2>;
+template struct ParticleReader<3>;
+template struct ParticleWriter<2>;
+template struct ParticleWriter<3>;
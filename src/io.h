@@ -1,16 +1,57 @@
 #ifndef _IO_H
 #define _IO_H
 
+#include <fstream>
 #include <vector>
 #include "particle.h"
 
+// The first line of a file contains the number of particles, optionally
+// followed by the dimension (2 if omitted). Each following line contains
+//   2D: index x y mass vx vy
+//   3D: index x y z mass vx vy vz
+
 // Reads only the first line of the file that contains the number of particles.
 int read_num_particles(char* inputfilename);
+// Reads only the first line of the file, and returns the dimension (2 or 3).
+int read_dimension(char* inputfilename);
 // Reads the given file and returns the data in a vector of Particles
-std::vector<Particle> read_file(char* inputfilename);
+template <int D>
+std::vector<Particle<D>> read_file(char* inputfilename);
+
+// Reads the particles of a file in chunks, in order, so the whole file
+// never has to be in memory (e.g. to send each process its slice).
+template <int D>
+struct ParticleReader {
+  std::ifstream ifs;
+  int num_particles; // From the first line
+
+  // Opens the file and reads its first line
+  ParticleReader(char* inputfilename);
+  // Reads the next count particles into particles. Returns the number read
+  // (less than count at the end of the file).
+  int read(Particle<D>* particles, int count);
+};
 
-// Writes the result vector of Particles to the specified output file.
+// Positions of the N particles in order of their index
+template <int D>
+std::vector<int> index_order(const Particle<D>* particles, int N);
+
+// Writes the result vector of Particles to the specified output file, in
+// order of their index (as read, whatever order they are in).
 // Use sci_notation to indicate whether to use scientific notation.
-void write_file(const std::vector<Particle>&, char* outputfilename, bool sci_notation);
+template <int D>
+void write_file(const Particle<D>* particles, int N, char* outputfilename, bool sci_notation);
+
+// Writes particles to a file in chunks, in the order given (the caller
+// restores the order of the indices, e.g. merging the processes' slices).
+template <int D>
+struct ParticleWriter {
+  std::ofstream ofs;
+
+  // Creates the file, and writes the first line for N particles
+  ParticleWriter(char* outputfilename, int N, bool sci_notation);
+  // Writes the count particles
+  void write(const Particle<D>* particles, int count);
+};
 
 #endif
\ No newline at end of file
@@ -0,0 +1,124 @@
+#ifndef _KERNELS_H
+#define _KERNELS_H
+
+#include <algorithm>
+#include <cmath>
+
+// Suggested constants
+constexpr double r_limit = 0.03; // Default softening length
+constexpr double G = 0.0001;
+
+// Reciprocal square root. With -fno-math-errno, std::sqrt compiles to a
+// single instruction (no call to set errno for negative arguments), so this
+// inlines to sqrt + divide, and vectorizes in loops.
+inline double rsqrt(double x) {
+  return 1/std::sqrt(x);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Force laws (kernel policies)
+////////////////////////////////////////////////////////////////////////////////
+//
+// Force calculations are templated on a kernel, so each force law gets its
+// own inlined inner loop, and the force law is chosen once per run (see
+// make_solver) instead of per interaction. For two particles separated by
+// dr = r2 - r1 with r2 = |dr|^2, a kernel gives
+//   force(r2):     g, so the force on m1 due to m2 is G*m1*m2*g*dr
+//                  (Newtonian: g = 1/r^3)
+//   potential(r2): phi, so their potential energy is G*m1*m2*phi
+//                  (Newtonian: phi = -1/r), consistent with force()
+// Both must be finite at r2 = 0 (a particle's own term in direct summation
+// is multiplied by dr = 0), and are branch-free: the pieces of a piecewise
+// law are all evaluated and the result is selected.
+//
+// Kernels with HAS_CUTOFF have no force beyond a cutoff radius, so tree
+// nodes entirely beyond it are skipped: beyond(d2) tells whether a node at
+// squared distance d2 can be skipped.
+
+// Legacy: Newtonian, with the distance clamped to at least eps (= r_limit).
+// Inside eps the force grows linearly with distance, and the potential is
+// the matching parabola (continuous with -1/eps at r = eps).
+struct ClampKernel {
+  static constexpr bool HAS_CUTOFF = false;
+  double eps;
+
+  double force(double r2) const {
+    double inv = rsqrt(std::max(r2, eps*eps));
+    return inv*inv*inv;
+  }
+  double potential(double r2) const {
+    double inside = (r2 - 3*eps*eps)/(2*eps*eps*eps);
+    double outside = -rsqrt(r2);
+    return (r2 < eps*eps ? inside : outside);
+  }
+  bool beyond(double) const { return false; }
+};
+
+// Plummer softening: the field of a Plummer sphere of scale length eps.
+//   g = (r^2 + eps^2)^(-3/2),  phi = -(r^2 + eps^2)^(-1/2)
+struct PlummerKernel {
+  static constexpr bool HAS_CUTOFF = false;
+  double eps;
+
+  double force(double r2) const {
+    double inv = rsqrt(r2 + eps*eps);
+    return inv*inv*inv;
+  }
+  double potential(double r2) const {
+    return -rsqrt(r2 + eps*eps);
+  }
+  bool beyond(double) const { return false; }
+};
+
+// Cubic spline softening (Monaghan & Lattanzio; as in GADGET): the field of
+// a spline density of radius h = 2.8*eps, exactly Newtonian beyond h. The
+// potential at r = 0 is -1/eps, as for Plummer softening with eps.
+struct SplineKernel {
+  static constexpr bool HAS_CUTOFF = false;
+  double eps;
+
+  double force(double r2) const {
+    double h = 2.8*eps;
+    double r = std::sqrt(r2);
+    double u = r/h;
+    double inner = 10.666666666667 + u*u*(32.0*u - 38.4);
+    double outer = 21.333333333333 - 48.0*u + 38.4*u*u
+                   - 10.666666666667*u*u*u - 0.066666666667/(u*u*u);
+    double soft = (u < 0.5 ? inner : outer)/(h*h*h);
+    return (u < 1 ? soft : 1/(r2*r));
+  }
+  double potential(double r2) const {
+    double h = 2.8*eps;
+    double r = std::sqrt(r2);
+    double u = r/h;
+    double inner = -2.8 + u*u*(5.333333333333 + u*u*(6.4*u - 9.6));
+    double outer = -3.2 + 0.066666666667/u + u*u*(10.666666666667
+                   + u*(-16.0 + u*(9.6 - 2.133333333333*u)));
+    double soft = (u < 0.5 ? inner : outer)/h;
+    return (u < 1 ? soft : -1/r);
+  }
+  bool beyond(double) const { return false; }
+};
+
+// Short-range cutoff: the legacy (clamped) law for r < r_cut, and no force
+// beyond r_cut. The potential is shifted by 1/r_cut to be continuous (0) at
+// r_cut.
+struct CutoffKernel {
+  static constexpr bool HAS_CUTOFF = true;
+  double eps;
+  double r_cut;
+
+  double force(double r2) const {
+    double inv = rsqrt(std::max(r2, eps*eps));
+    return (r2 < r_cut*r_cut ? inv*inv*inv : 0);
+  }
+  double potential(double r2) const {
+    double inside = (r2 - 3*eps*eps)/(2*eps*eps*eps);
+    double outside = -rsqrt(r2);
+    double phi = (r2 < eps*eps ? inside : outside) + 1/r_cut;
+    return (r2 < r_cut*r_cut ? phi : 0);
+  }
+  bool beyond(double d2) const { return d2 >= r_cut*r_cut; }
+};
+
+#endif // _KERNELS_H
@@ -6,19 +6,15 @@
 //       position(Vec2<double>()), 
 //       velocity(Vec2<double>()) {};
 
-bool coincident(Particle* a, Particle* b) {
-  return a->position.x == b->position.x && 
-         a->position.y == b->position.y;
-}
-
 ////////////////////////////////////////////////////////////////////////////////
 // Physics update
 ////////////////////////////////////////////////////////////////////////////////
-void Particle::update(Vec2<double> force, double dt) {
+template <int D>
+bool Particle<D>::update(Vec<double, D> force, double dt) {
   // Ignore lost particles
-  if (mass == -1) return;
+  if (mass == -1) return true;
   // Integrate to find next position
-  Vec2<double> acceleration = force/mass;
+  Vec<double, D> acceleration = force/mass;
   auto& a = acceleration;
   auto& v = velocity;
   auto& r = position;
@@ -28,6 +24,7 @@ void Particle::update(Vec2<double> force, double dt) {
   // Update position & velocity (Method 2: 7 ops)
   // r = r + (v + 0.5*a*dt)*dt;  // Save 1 op using by factoring out dt
   // v = v + a*dt;
+  return isfinite(r) && isfinite(v);
 }
 
 
@@ -36,7 +33,8 @@ void Particle::update(Vec2<double> force, double dt) {
 // String
 ////////////////////////////////////////////////////////////////////////////////
 
-std::string Particle::toString() const {
+template <int D>
+std::string Particle<D>::toString() const {
   std::stringstream ss;
   ss << "Particle: [idx: "      << index  << ", "
                 << "mass: "     << mass   << ", "
@@ -45,7 +43,8 @@ std::string Particle::toString() const {
   return ss.str();
 }
 
-std::string Particle::toStringMatchInput(bool show_address) const {
+template <int D>
+std::string Particle<D>::toStringMatchInput(bool show_address) const {
   std::stringstream ss;
   ss << "Particle: [idx: "      << index  << ", "
                 << "position: " << position.toString() << ", "
@@ -55,4 +54,10 @@ std::string Particle::toStringMatchInput(bool show_address) const {
     ss << " @ " << this;
   }
   return ss.str();
-}
\ No newline at end of file
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Instantiations for 2D & 3D
+////////////////////////////////////////////////////////////////////////////////
+template struct Particle<2>;
+template struct Particle<3>;
@@ -3,20 +3,22 @@
 
 #include "vector.h"
 
+// Particle in D dimensions (D = 2 or 3)
+template <int D>
 struct Particle {
   int index;
   double mass;
-  Vec2<double> position;
-  Vec2<double> velocity;
+  Vec<double, D> position;
+  Vec<double, D> velocity;
 
   Particle() = default;
   // Particle();
 
-  void update(Vec2<double> force, double dt);
+  // Advances the particle by dt under the force. Returns false if the new
+  // position or velocity is not finite (the simulation blew up).
+  bool update(Vec<double, D> force, double dt);
   std::string toString() const;
   std::string toStringMatchInput(bool) const;
 };
 
-bool coincident(Particle* a, Particle* b);
-
-#endif
\ No newline at end of file
+#endif
@@ -1,68 +1,89 @@
 #include "vector.h"
 #include "particle.h"
 #include "physics.h"
+#include <algorithm>
 
-// Suggested constants
-constexpr double r_limit = 0.03;
-constexpr double G = 0.0001;
+// Returns whether the node can be skipped by a kernel with a cutoff: all of
+// its particles are beyond the cutoff from p. (Always false otherwise, and
+// removed by the compiler.)
+template <int D, typename Kernel>
+static bool beyond_cutoff(const Particle<D>* p, const TreeNode<D>* n,
+                          const Kernel& kernel) {
+  if constexpr (Kernel::HAS_CUTOFF) {
+    return kernel.beyond(min_dist2(p->position, n->region));
+  }
+  return false;
+}
 
-// Returns the force exerted on m1 (at position r1) by m2 (at position r2)
-Vec2<double> gravity(double m1, double m2, Vec2<double> r1, Vec2<double> r2) {
-  // Compute separation distance d. Use r_limit if d < r_limit.
-  double d = dist(r1, r2);
-  d = std::max(d, r_limit);
-  // Compute force with inverse square law:
-  // For m1 at position r and m2 at position r', the force (m2 on m1) is:
-  // f = G*m1*m2*(r'-r) / |r'-r|^3
-  return G*m1*m2*(r2-r1)/(d*d*d);
+// Returns whether the node is far enough from p to approximate it by its
+// center of mass: s/d < theta, compared squared to avoid a sqrt & divide.
+template <int D>
+static bool far_enough(const Particle<D>* p, const TreeNode<D>* n,
+                       double theta) {
+  double s = n->region.side_length();
+  return s*s < theta*theta*dist2(p->position, n->com);
 }
 
-// Recursively traverses the quadtree in-order and writes the result in the
-// output parameter f.
-// 
-// For each nodes containing only 1 particle or meeting the approximation
-// threshold, the gravitational force (or approximation) is computed and added
-// to the net force. Otherwise, the function examines the nodes below.
-void calc_net_force(const Particle* p, QuadtreeNode* node, double theta,
-                    Vec2<double>& f) {
-  // If the node is nullptr, do nothing and return.
-  if (node == nullptr) {
+// Recursively traverses the tree in-order and adds the potential energy of
+// p to u: for each node containing only 1 particle or meeting the
+// approximation threshold, that of the particle (or of the node's center of
+// mass). Otherwise, the function examines the nodes below.
+template <int D, typename Kernel>
+static void calc_potential(const Particle<D>* p, const TreeNode<D>* nodes,
+                           int node, double theta, const Kernel& kernel,
+                           double& u) {
+  if (node == -1) {
+    return;
+  }
+  const TreeNode<D>* n = &nodes[node];
+  if (beyond_cutoff(p, n, kernel)) {
     return;
   }
-  // If there is only 1 particle, compute force due to it and add to f.
-  if (node->num_particles == 1) {
-    Particle* q = node->particle;
-    // A particle does not exert force on itself.
-    if (q->index != p->index) {
-      f += gravity(p->mass, q->mass, p->position, q->position);
+  if (n->num_particles == 1) {
+    if (n->particle != p->index) {
+      u += potential(p->mass, n->total_mass, p->position, n->com, kernel);
     }
     return;
   }
-  // If s/d < theta, approximate the force from all particles in this node
-  // as that from a point mass located at the center of mass with a mass equal
-  // to the total mass of all particles within.
-  double s = node->region.side_length();
-  double d = dist(p->position, node->com);
-  if (s/d < theta) {
-    f += gravity(p->mass, node->total_mass, p->position, node->com);
+  if (far_enough(p, n, theta)) {
+    u += potential(p->mass, n->total_mass, p->position, n->com, kernel);
     return;
   }
-  // Otherwise, no approximation can be made, and we need to recursively
-  // examine all nodes under this one.
-  calc_net_force(p, node->quadrants[Quadrant::NE], theta, f);
-  calc_net_force(p, node->quadrants[Quadrant::NW], theta, f);
-  calc_net_force(p, node->quadrants[Quadrant::SW], theta, f);
-  calc_net_force(p, node->quadrants[Quadrant::SE], theta, f);
+  for (int c = 0; c < TreeNode<D>::NUM_CHILDREN; ++c) {
+    calc_potential(p, nodes, n->children[c], theta, kernel, u);
+  }
 }
 
-// Calculate the net force on particle p from all other particles in the
-// quadtree using the given value of theta as a threshold for approximations.
-// Note: force vector is returned by value
-Vec2<double> calc_net_force(const Particle& p, const Quadtree& tree, double theta) {
+// Calculate the potential energy of particle p with all other particles in
+// the tree nodes, using the given value of theta as a threshold for
+// approximations.
+template <int D, typename Kernel>
+double calc_potential(const Particle<D>& p, const TreeNode<D>* nodes,
+                      int num_nodes, double theta, const Kernel& kernel) {
   // Ignore lost particles
-  if (p.mass == -1) return {0,0};
-  // Create 0 vector to start, modify, then return
-  Vec2<double> force = {0,0};
-  calc_net_force(&p, tree.root, theta, force);  
-  return force;
+  if (p.mass == -1) return 0;
+  double u = 0;
+  calc_potential(&p, nodes, num_nodes > 0 ? 0 : -1, theta, kernel, u);
+  return u;
 }
+
+////////////////////////////////////////////////////////////////////////////////
+// Instantiations for 2D & 3D, and each kernel
+////////////////////////////////////////////////////////////////////////////////
+template double calc_potential(const Particle<2>&, const TreeNode<2>*,
+                               int, double, const ClampKernel&);
+template double calc_potential(const Particle<2>&, const TreeNode<2>*,
+                               int, double, const PlummerKernel&);
+template double calc_potential(const Particle<2>&, const TreeNode<2>*,
+                               int, double, const SplineKernel&);
+template double calc_potential(const Particle<2>&, const TreeNode<2>*,
+                               int, double, const CutoffKernel&);
+
+template double calc_potential(const Particle<3>&, const TreeNode<3>*,
+                               int, double, const ClampKernel&);
+template double calc_potential(const Particle<3>&, const TreeNode<3>*,
+                               int, double, const PlummerKernel&);
+template double calc_potential(const Particle<3>&, const TreeNode<3>*,
+                               int, double, const SplineKernel&);
+template double calc_potential(const Particle<3>&, const TreeNode<3>*,
+                               int, double, const CutoffKernel&);
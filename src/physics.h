@@ -3,10 +3,38 @@
 
 #include <iostream>
 #include <vector>
+#include "kernels.h"
 #include "quadtree.h"
 #include "vector.h"
 
-Vec2<double> calc_net_force(const Particle& p, const Quadtree& tree, double theta);
-void calc_net_force(const Particle& p, const Quadtree& tree, double theta, Vec2<double>& f);
+// All functions are defined for D = 2 (quadtree) and D = 3 (octree), and
+// for each force law of kernels.h (Kernel), which is inlined into them.
 
-#endif // _PHYSICS_H
\ No newline at end of file
+// Force exerted on m1 (at position r1) by m2 (at position r2):
+// f = G*m1*m2*g*(r2-r1), with g = 1/|r2-r1|^3 softened by the kernel
+template <int D, typename Kernel>
+Vec<double, D> gravity(double m1, double m2,
+                       const Vec<double, D>& r1, const Vec<double, D>& r2,
+                       const Kernel& kernel) {
+  Vec<double, D> dr = r2 - r1;
+  return (G*m1*m2*kernel.force(len2(dr)))*dr;
+}
+
+// Potential energy of m1 (at position r1) and m2 (at position r2),
+// consistent with gravity()
+template <int D, typename Kernel>
+double potential(double m1, double m2,
+                 const Vec<double, D>& r1, const Vec<double, D>& r2,
+                 const Kernel& kernel) {
+  return G*m1*m2*kernel.potential(dist2(r1, r2));
+}
+
+// Potential energy of particle p with all other particles in the tree nodes
+// (root first, as stored by Tree), approximated using theta (s/d < theta for
+// p alone; forces are calculated by the group walks of walk.h). The sum over
+// particles of these counts every pair twice.
+template <int D, typename Kernel>
+double calc_potential(const Particle<D>& p, const TreeNode<D>* nodes,
+                      int num_nodes, double theta, const Kernel& kernel);
+
+#endif // _PHYSICS_H
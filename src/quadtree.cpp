@@ -1,37 +1,43 @@
 #include "quadtree.h"
+#include <new>
+#include <utility>
 
 ////////////////////////////////////////////////////////////////////////////////
-// QuadtreeNode
+// TreeNode
 ////////////////////////////////////////////////////////////////////////////////
-QuadtreeNode::QuadtreeNode(Region<double> r) 
+template <int D>
+TreeNode<D>::TreeNode(Region<double, D> r) 
       : region(r), 
-        particle(nullptr),
-        quadrants({nullptr, nullptr, nullptr, nullptr}), 
+        particle(-1),
         total_mass(0), // default-construct: 0 for numeric
         num_particles(0),
-        com(Vec2<double>(0, 0)) 
-        {}
+        com() // 0 vector
+        {
+  children.fill(-1);
+}
 
-QuadtreeNode::QuadtreeNode(Region<double> r, Particle* p)
+template <int D>
+TreeNode<D>::TreeNode(Region<double, D> r, const Particle<D>& p)
       : region(r),
-        particle(p),
-        quadrants({nullptr, nullptr, nullptr, nullptr}),
-        total_mass(p->mass),
+        particle(p.index),
+        total_mass(p.mass),
         num_particles(1),
-        com(p->position)
-        {}
+        com(p.position)
+        {
+  children.fill(-1);
+}
 
-std::string QuadtreeNode::toString() {
+template <int D>
+std::string TreeNode<D>::toString() {
     std::stringstream ss;
     ss << "@: "             << this                           << ", "
        << "Region: "        << region.toString()              << ", "
-       << "particle: "      << (particle != nullptr ?       
-                                particle->toStringMatchInput(true) : 
-                                "nullptr") << ", "
-       << "quadrants: ["    << quadrants[Quadrant::NE] << ", "
-                            << quadrants[Quadrant::NW] << ", "
-                            << quadrants[Quadrant::SW] << ", "
-                            << quadrants[Quadrant::SE] << "]" << ", "
+       << "particle: "      << particle                       << ", "
+       << "children: [";
+    for (int c = 0; c < NUM_CHILDREN; ++c) {
+      ss << (c > 0 ? ", " : "") << children[c];
+    }
+    ss << "]" << ", "
        << "total_mass: "    << total_mass                     << ", "
        << "num_particles: " << num_particles                  << ", "
        << "com: "           << com.toString();
@@ -39,34 +45,53 @@ std::string QuadtreeNode::toString() {
 }
 
 ////////////////////////////////////////////////////////////////////////////////
-// Quadtree
+// Tree
 ////////////////////////////////////////////////////////////////////////////////
-Quadtree::Quadtree(const Region<double>& r) 
-    : region(r), 
-      root(nullptr) {}
+template <int D>
+Tree<D>::Tree(const Region<double, D>& r) 
+    : region(r),
+      nodes(nullptr),
+      num_nodes(0),
+      external(false),
+      capacity(0),
+      overflow(false) {}
 
-Quadtree::~Quadtree() {
-  destroy(root);
+template <int D>
+Tree<D>::Tree(const Region<double, D>& r, TreeNode<D>* storage, int c)
+    : region(r),
+      nodes(storage),
+      num_nodes(0),
+      external(true),
+      capacity(c),
+      overflow(false) {}
+
+template <int D>
+void Tree<D>::clear() {
+  own.clear();
+  num_nodes = 0;
+  overflow = false;
 }
 
-void Quadtree::destroy(QuadtreeNode* root) {
-  if (root == nullptr) return;
-  destroy(root->quadrants[Quadrant::NE]);
-  destroy(root->quadrants[Quadrant::NW]);
-  destroy(root->quadrants[Quadrant::SW]);
-  destroy(root->quadrants[Quadrant::SE]);
-  delete root;
+template <int D>
+void Tree<D>::attach(TreeNode<D>* storage, int c) {
+  clear();
+  own.shrink_to_fit();
+  nodes = storage;
+  external = true;
+  capacity = c;
 }
 
-// Inserts the particle into the Quadtree
+// Inserts the particle into the tree
 // Returns: 
 //   true if the particle was inside the bounds and inserted, or
 //   false if the particle is not in the bounds (also sets mass = -1)
-bool Quadtree::insert(Particle& p) {
-  // If particle p is inside the root region, insert it into the quadtree
+template <int D>
+bool Tree<D>::insert(Particle<D>& p) {
+  // If particle p is inside the root region, insert it into the tree
   if (isContained(p, region)) {
-    // Use private helping insert method
-    root = insert(root, region, &p);
+    // Use private helping insert method (nothing more fits in a full tree,
+    // which has to be rebuilt anyway)
+    if (!overflow) { insert(num_nodes == 0 ? -1 : 0, region, p); }
     return true;
   }
   // If particle p is outside the region, it is lost.
@@ -80,51 +105,119 @@ bool Quadtree::insert(Particle& p) {
   }
 }
 
-// Recursively inserts the particle into the Quadtree, starting at the 
-// given node (root) and corresponding to the region passed in.
+// Recursively inserts the particle into the tree, starting at the 
+// node at the given position (root) and corresponding to the region passed
+// in. Returns the position of the node (new if root == -1).
 // 
-// Note: Each QuadtreeNode contains its region as a member, but insert uses
+// Note: Each TreeNode contains its region as a member, but insert uses
 // the region as a parameter on the call stack, to be available for
-// constructing a new node when root == nullptr.
-QuadtreeNode* Quadtree::insert(QuadtreeNode* root, 
-                               Region<double> region, 
-                               Particle* p) {
-  // If node is null, create new node for this region containing the particle
-  if (root == nullptr) {
-    return new QuadtreeNode(region, p); 
+// constructing a new node when root == -1.
+// Note: Inserting may reallocate the own storage, so nodes are always
+// accessed by position (never by reference) across recursive calls.
+// If the tree becomes full, the insertion is left incomplete.
+template <int D>
+int Tree<D>::insert(int root, Region<double, D> region, const Particle<D>& p) {
+  // If there is no node, create new node for this region containing particle
+  if (root == -1) {
+    return add_node(region, p);
   };
 
   // Internal node (contains no particles directly) or newly empty leaf node
-  if (root->particle == nullptr) {
+  if (nodes[root].particle == -1) {
     // Update center of mass (com)
-    auto n = (root->com)*(root->total_mass) + (p->mass)*(p->position);
-    auto d = root->total_mass + p->mass;
-    root->com = n/d;
+    TreeNode<D>& node = nodes[root];
+    auto n = (node.com)*(node.total_mass) + (p.mass)*(p.position);
+    auto d = node.total_mass + p.mass;
+    node.com = n/d;
     // Update number of particles & total mass
-    root->num_particles++;
-    root->total_mass += p->mass;
-    // Insert into appropriate quadrant
-    Quadrant q = quadrant(*p, region);
-    root->quadrants[q] = insert(root->quadrants[q], region.subregion(q), p);
+    node.num_particles++;
+    node.total_mass += p.mass;
+    // Insert into appropriate child (quadrant/octant)
+    int c = child(p, region);
+    int node_c = insert(nodes[root].children[c], region.subregion(c), p);
+    nodes[root].children[c] = node_c;
     return root;
   }
 
   // Leaf node (already contains particle)
-  else { // root->particle != nullptr
+  else { // nodes[root].particle != -1
     // If particles have same position, no amount of zoom will separate them.
     // Do not add the coincident particle and return this node unchanged.
-    if (coincident(p, root->particle)) { return root; }
+    if (p.position == nodes[root].com) { return root; }
 
-    // Save particle that was here & remove it
-    Particle* prev = root->particle;
-    root->particle = nullptr;
+    // Save particle that was here (recovered from the leaf) & remove it
+    Particle<D> prev;
+    prev.index = nodes[root].particle;
+    prev.mass = nodes[root].total_mass;
+    prev.position = nodes[root].com;
+    nodes[root].particle = -1;
     // Reset fields
-    root->total_mass = 0;
-    root->num_particles = 0;
-    root->com = {0, 0};
+    nodes[root].total_mass = 0;
+    nodes[root].num_particles = 0;
+    nodes[root].com = Vec<double, D>(); // 0 vector
     // Re-insert both particles starting at this node
-    root = insert(root, region, prev);
-    root = insert(root, region, p);
+    insert(root, region, prev);
+    insert(root, region, p);
     return root;
   }
 }
+
+template <int D>
+int Tree<D>::add_node(const Region<double, D>& region, const Particle<D>& p) {
+  if (external) {
+    if (num_nodes == capacity) {
+      overflow = true;
+      return -1;
+    }
+    new (&nodes[num_nodes]) TreeNode<D>(region, p);
+  } else {
+    own.emplace_back(region, p);
+    nodes = own.data();
+  }
+  return num_nodes++;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Morton order
+////////////////////////////////////////////////////////////////////////////////
+template <int D>
+void morton_sort(Particle<D>* particles, int N,
+                 const Region<double, D>& region, MortonKeys& keys) {
+  keys.resize(N);
+  for (int i = 0; i < N; ++i) {
+    keys[i] = {morton_key(particles[i].position, region), i};
+  }
+  std::sort(keys.begin(), keys.end(),
+            [&](const std::pair<uint64_t, int>& a,
+                const std::pair<uint64_t, int>& b) {
+              if (a.first != b.first) return a.first < b.first;
+              return particles[a.second].index < particles[b.second].index;
+            });
+  // Position i gets the particle at keys[i].second: follow each cycle of
+  // the permutation, marking moved positions with keys[j].second = j
+  for (int i = 0; i < N; ++i) {
+    if (keys[i].second == i) continue;
+    Particle<D> first = particles[i];
+    int j = i;
+    while (keys[j].second != i) {
+      int k = keys[j].second;
+      particles[j] = particles[k];
+      keys[j].second = j;
+      j = k;
+    }
+    particles[j] = first;
+    keys[j].second = j;
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Instantiations for 2D (quadtree) & 3D (octree)
+////////////////////////////////////////////////////////////////////////////////
+template struct TreeNode<2>;
+template struct TreeNode<3>;
+template struct Tree<2>;
+template struct Tree<3>;
+template void morton_sort(Particle<2>*, int, const Region<double, 2>&,
+                          MortonKeys&);
+template void morton_sort(Particle<3>*, int, const Region<double, 3>&,
+                          MortonKeys&);
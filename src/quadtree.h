@@ -1,113 +1,220 @@
 #ifndef _QUADTREE_H
 #define _QUADTREE_H
 
+#include <algorithm>
 #include <array>
+#include <cstdint>
 #include <iostream>
 #include <sstream>
 #include <string>
+#include <utility>
+#include <vector>
 #include "particle.h"
 #include "vector.h"
 
 ////////////////////////////////////////////////////////////////////////////////
-// Quadrant & Region
+// Region & Children
 ////////////////////////////////////////////////////////////////////////////////
 
-// Enumerates quadrants of a rectangular region
-enum Quadrant {
-  NE, 
-  NW, 
-  SW,
-  SE, 
-  None
-};
-
-// Represents a rectangular region in the xy-plane
-template <typename T>
+// Represents a square (D = 2) or cubic (D = 3) region
+template <typename T, int D>
 struct Region {
-  T x_min;
-  T x_max;
-  T y_min;
-  T y_max;
-
-  T x_center() const { return (x_min + x_max)/2; }
-  T y_center() const { return (y_min + y_max)/2; }
-  T side_length() const { return x_max - x_min; } // Assume square
-  
-  Region<T> subregion(Quadrant q) {
-    if (q == Quadrant::NE) return Region{x_center(), x_max, y_center(), y_max};
-    if (q == Quadrant::NW) return Region{x_min, x_center(), y_center(), y_max};
-    if (q == Quadrant::SW) return Region{x_min, x_center(), y_min, y_center()};
-    if (q == Quadrant::SE) return Region{x_center(), x_max, y_min, y_center()};
-    return Region{0, 0, 0, 0};
+  Vec<T, D> min;  // Lower corner
+  Vec<T, D> max;  // Upper corner
+
+  // Region [lo, hi] in every dimension
+  static Region<T, D> cube(T lo, T hi) {
+    Region<T, D> r;
+    for (int i = 0; i < D; ++i) { r.min[i] = lo; r.max[i] = hi; }
+    return r;
+  }
+
+  T center(int i) const { return (min[i] + max[i])/2; }
+  T side_length() const { return max[0] - min[0]; } // Assume square/cube
+
+  // Returns the subregion for the child with the given index (see child())
+  Region<T, D> subregion(int c) const {
+    Region<T, D> r;
+    for (int i = 0; i < D; ++i) {
+      bool upper = (c >> i) & 1;
+      r.min[i] = upper ? center(i) : min[i];
+      r.max[i] = upper ? max[i] : center(i);
+    }
+    return r;
   }
 
-  std::string toString() {
+  std::string toString() const {
     std::stringstream ss;
-    ss << "[ x_min: " << x_min << ", x_max: " << x_max
-       << ", y_min: " << y_min << ", y_max: " << y_max << " ]";
+    ss << "[ min: " << min.toString() << ", max: " << max.toString() << " ]";
     return ss.str();
   }
 };
 
-// Returns whether the particle is contained in the rectangular region.
+// Returns whether the particle is contained in the region.
 // Note: A particle on an edge or corner is considered to be in the region.
-template <typename T>
-bool isContained(const Particle& p, const Region<T>& r) {
-  return (r.x_min <= p.position.x && p.position.x <= r.x_max) &&
-         (r.y_min <= p.position.y && p.position.y <= r.y_max);
+template <typename T, int D>
+bool isContained(const Particle<D>& p, const Region<T, D>& r) {
+  for (int i = 0; i < D; ++i) {
+    if (!(r.min[i] <= p.position[i] && p.position[i] <= r.max[i])) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Returns the squared distance from the position to the nearest point of the
+// region (0 if the position is in it)
+template <typename T, int D>
+T min_dist2(const Vec<T, D>& position, const Region<T, D>& r) {
+  T d2 = 0;
+  for (int i = 0; i < D; ++i) {
+    T d = std::max({r.min[i] - position[i], position[i] - r.max[i], T(0)});
+    d2 += d*d;
+  }
+  return d2;
+}
+
+// Returns the squared distance between the nearest points of two regions
+// (0 if they overlap)
+template <typename T, int D>
+T min_dist2(const Region<T, D>& a, const Region<T, D>& b) {
+  T d2 = 0;
+  for (int i = 0; i < D; ++i) {
+    T d = std::max({a.min[i] - b.max[i], b.min[i] - a.max[i], T(0)});
+    d2 += d*d;
+  }
+  return d2;
 }
 
-// Returns the quadrant of the region the particle lies in.
+// Returns the index of the child (quadrant in 2D, octant in 3D) of the region
+// the particle lies in: bit i is set if the particle is in the upper half of
+// the region in dimension i (x: bit 0, y: bit 1, z: bit 2). Children are thus
+// in Morton (Z-curve) order.
+// A particle on a center line/plane is in the upper half in x, but in the
+// lower half in y (and z), as in the original quadtree (NE/NW only for
+// y > center), so 2D trees keep their shape.
 // Note: This function does not check whether the particle is in the region,
-// because this this was checked before it was inserted in the quadtree.
-template <typename T>
-Quadrant quadrant(const Particle& p, const Region<T>& r) {
-  if (p.position.y > r.y_center()) {
-    return (p.position.x < r.x_center() ? Quadrant::NW : Quadrant::NE);
-  } else {
-    return (p.position.x < r.x_center() ? Quadrant::SW : Quadrant::SE);
+// because this this was checked before it was inserted in the tree.
+template <typename T, int D>
+int child(const Particle<D>& p, const Region<T, D>& r) {
+  int c = (p.position[0] >= r.center(0) ? 1 : 0);
+  for (int i = 1; i < D; ++i) {
+    c |= (p.position[i] > r.center(i) ? 1 : 0) << i;
   }
+  return c;
 }
 
+// Returns the Morton key of the position in the region: the bits of the
+// cell coordinates (of a grid of 2^bits cells per dimension) interleaved.
+// Sorting by key orders positions along the Z-curve, the order in which the
+// tree visits its leaves. bits = 64/D, so keys fit in 64 bits.
+template <typename T, int D>
+uint64_t morton_key(const Vec<T, D>& position, const Region<T, D>& r) {
+  constexpr int bits = 64/D;
+  constexpr uint64_t cells = uint64_t(1) << bits;
+  uint64_t key = 0;
+  for (int i = 0; i < D; ++i) {
+    double f = (position[i] - r.min[i]) / (r.max[i] - r.min[i]);
+    f = (f < 0 ? 0 : (f > 1 ? 1 : f));
+    uint64_t cell = std::min<uint64_t>(f * cells, cells - 1);
+    // Spread the bits of cell to every D-th bit of key
+    for (int b = 0; b < bits; ++b) {
+      key |= ((cell >> b) & 1) << (b*D + i);
+    }
+  }
+  return key;
+}
+
+// Reorders the N particles in place along the Morton curve of the region
+// (particles with equal keys by index, so the order is deterministic).
+// Particles that are close in space are then close in memory, as in the
+// tree, and any contiguous range of them is spatially compact.
+// keys is a buffer of N (key, position) pairs, kept by the caller to be
+// reused by later sorts (the particles are permuted in place).
+using MortonKeys = std::vector<std::pair<uint64_t, int>>;
+template <int D>
+void morton_sort(Particle<D>* particles, int N,
+                 const Region<double, D>& region, MortonKeys& keys);
+
 ////////////////////////////////////////////////////////////////////////////////
-// QuadtreeNode
+// TreeNode
 ////////////////////////////////////////////////////////////////////////////////
 
-struct QuadtreeNode {
-  Region<double> region;  // Bounds
-  Particle* particle;     // -internal node: nullptr
-                          // -leaf node: pointer to particle
-  std::array<QuadtreeNode*, 4> quadrants; // Array of pointers to child nodes
-
-  double total_mass;  // Sum of particle masses in this region
-  int num_particles;  // Number of particles in this region
-  Vec2<double> com;   // Position of center of mass for this region
-
-  // Construct a quadtree node for the given region, empty with no particles
-  QuadtreeNode(Region<double> r);
-  // Construct a quadtree node the region containing the 1 particle passed in
-  QuadtreeNode(Region<double> r, Particle* p);
-  
+template <int D>
+struct TreeNode {
+  static constexpr int NUM_CHILDREN = 1 << D; // 4 (quadtree) or 8 (octree)
+
+  Region<double, D> region; // Bounds
+  int particle;             // -internal node: -1
+                            // -leaf node: index of the particle (.index)
+  std::array<int, NUM_CHILDREN> children; // Positions of child nodes in the
+                                          // node array (-1 if no child)
+
+  double total_mass;    // Sum of particle masses in this region
+  int num_particles;    // Number of particles in this region
+  Vec<double, D> com;   // Position of center of mass for this region
+                        // (for a leaf node: mass & position of its particle)
+
+  // Construct a tree node for the given region, empty with no particles
+  TreeNode(Region<double, D> r);
+  // Construct a tree node the region containing the 1 particle passed in
+  TreeNode(Region<double, D> r, const Particle<D>& p);
+
   std::string toString();
 };
 
 ////////////////////////////////////////////////////////////////////////////////
-// Quadtree
+// Tree
 ////////////////////////////////////////////////////////////////////////////////
-struct Quadtree {
-  const Region<double> region;
-  QuadtreeNode* root;
-
-  Quadtree(const Region<double>& region);
-  Quadtree(const Quadtree&) = delete;
-  ~Quadtree();
-  Quadtree& operator=(const Quadtree&) = delete;
-
-  bool insert(Particle& p);
-
-  private: 
-  QuadtreeNode* insert(QuadtreeNode*, Region<double>, Particle* p);
-  void destroy(QuadtreeNode* node);
+// Barnes-Hut tree in D dimensions: quadtree (D = 2) or octree (D = 3).
+//
+// Nodes are stored contiguously and refer to their children by position in
+// the node array (the root is nodes[0]), instead of by pointer. The nodes
+// also do not point to the particles, so a tree is self-contained and can be
+// read as a block of memory (e.g. by other processes sharing it).
+//
+// The storage is either the tree's own, grown as needed, or external (e.g.
+// a shared memory window) with a fixed capacity: if the nodes do not fit,
+// the tree is full() and ignores further insertions, and must be rebuilt in
+// larger storage (see attach()).
+// The storage is kept by clear() to be reused by the next step.
+template <int D>
+struct Tree {
+  const Region<double, D> region;
+  TreeNode<D>* nodes; // Root first
+  int num_nodes;
+
+  // Tree in its own storage
+  Tree(const Region<double, D>& region);
+  // Tree in the external storage of capacity nodes
+  Tree(const Region<double, D>& region, TreeNode<D>* storage, int capacity);
+  Tree(const Tree&) = delete;
+  Tree& operator=(const Tree&) = delete;
+
+  bool insert(Particle<D>& p);
+  // Removes all nodes (keeps the allocated storage)
+  void clear();
+  // Clears the tree and moves it to the external storage of capacity nodes
+  void attach(TreeNode<D>* storage, int capacity);
+  // Whether a node did not fit in the external storage
+  bool full() const { return overflow; }
+  // Size of the tree's own storage (0 for external storage)
+  double bytes() const { return (double)own.capacity()*sizeof(TreeNode<D>); }
+
+  private:
+  std::vector<TreeNode<D>> own; // Own storage (unused if external)
+  bool external;
+  int capacity;                 // Of the external storage
+  bool overflow;
+
+  int insert(int node, Region<double, D>, const Particle<D>& p);
+  // Appends a leaf node: returns its position (-1 if full)
+  int add_node(const Region<double, D>& region, const Particle<D>& p);
 };
 
-#endif // _QUADTREE_H
\ No newline at end of file
+using QuadtreeNode = TreeNode<2>;
+using OctreeNode = TreeNode<3>;
+using Quadtree = Tree<2>;
+using Octree = Tree<3>;
+
+#endif // _QUADTREE_H
@@ -0,0 +1,139 @@
+#include "shared.h"
+#include <algorithm>
+
+////////////////////////////////////////////////////////////////////////////////
+// Setup
+////////////////////////////////////////////////////////////////////////////////
+template <int D>
+SharedMemory<D>::SharedMemory(MPI_Comm c, int N)
+    : comm(c),
+      leader_comm(MPI_COMM_NULL),
+      N_particles(N),
+      particles(nullptr),
+      tree_nodes(nullptr),
+      tree_capacity(0),
+      num_tree_nodes(0) {
+  int rank; MPI_Comm_rank(comm, &rank);
+  int size; MPI_Comm_size(comm, &size);
+
+  // Node-local communicator, and communicator of node leaders.
+  // Using rank as key makes process 0 of comm the leader of node 0.
+  MPI_Comm_split_type(comm, MPI_COMM_TYPE_SHARED, rank, MPI_INFO_NULL,
+                      &node_comm);
+  MPI_Comm_rank(node_comm, &node_rank);
+  MPI_Comm_size(node_comm, &node_size);
+  MPI_Comm_split(comm, is_leader() ? 0 : MPI_UNDEFINED, rank, &leader_comm);
+
+  // Leaders learn the sizes of all nodes, then share them with their node
+  if (is_leader()) {
+    MPI_Comm_rank(leader_comm, &node_id);
+    MPI_Comm_size(leader_comm, &num_nodes);
+  }
+  MPI_Bcast(&node_id, 1, MPI_INT, 0, node_comm);
+  MPI_Bcast(&num_nodes, 1, MPI_INT, 0, node_comm);
+  std::vector<int> node_sizes(num_nodes);
+  if (is_leader()) {
+    MPI_Allgather(&node_size, 1, MPI_INT,
+                  node_sizes.data(), 1, MPI_INT, leader_comm);
+  }
+  MPI_Bcast(node_sizes.data(), num_nodes, MPI_INT, 0, node_comm);
+
+  // Divide particles among processes ordered by (node, rank on node).
+  // The first r processes in that order get 1 extra particle.
+  int q = N_particles / size;
+  int r = N_particles % size;
+  auto slice_start = [q, r](int i) { return i*q + std::min(i, r); };
+  std::vector<int> first(num_nodes + 1, 0); // Position of node's 1st process
+  for (int j = 0; j < num_nodes; ++j) {
+    first[j + 1] = first[j] + node_sizes[j];
+  }
+  start = slice_start(first[node_id] + node_rank);
+  end = slice_start(first[node_id] + node_rank + 1);
+  node_counts.resize(num_nodes);
+  node_displacements.resize(num_nodes);
+  for (int j = 0; j < num_nodes; ++j) {
+    int block_start = slice_start(first[j]);
+    int block_end = slice_start(first[j + 1]);
+    node_counts[j] = (block_end - block_start) * sizeof(Particle<D>);
+    node_displacements[j] = block_start * sizeof(Particle<D>);
+  }
+
+  // Shared particles array, allocated (only) by the leader
+  MPI_Aint bytes = is_leader() ? N_particles * sizeof(Particle<D>) : 0;
+  Particle<D>* base = nullptr;
+  MPI_Win_allocate_shared(bytes, sizeof(Particle<D>), MPI_INFO_NULL, node_comm,
+                          &base, &particles_win);
+  int disp_unit = 0;
+  MPI_Win_shared_query(particles_win, 0, &bytes, &disp_unit, &particles);
+  MPI_Win_lock_all(MPI_MODE_NOCHECK, particles_win);
+
+  // Shared tree, sized for the typical number of nodes
+  allocate_tree(2 * N_particles + 1);
+}
+
+template <int D>
+SharedMemory<D>::~SharedMemory() {
+  MPI_Win_unlock_all(tree_win);
+  MPI_Win_free(&tree_win);
+  MPI_Win_unlock_all(particles_win);
+  MPI_Win_free(&particles_win);
+  if (leader_comm != MPI_COMM_NULL) { MPI_Comm_free(&leader_comm); }
+  MPI_Comm_free(&node_comm);
+}
+
+template <int D>
+void SharedMemory<D>::allocate_tree(int capacity) {
+  MPI_Aint bytes = is_leader() ? capacity * sizeof(TreeNode<D>) : 0;
+  TreeNode<D>* base = nullptr;
+  MPI_Win_allocate_shared(bytes, sizeof(TreeNode<D>), MPI_INFO_NULL,
+                          node_comm, &base, &tree_win);
+  int disp_unit = 0;
+  MPI_Win_shared_query(tree_win, 0, &bytes, &disp_unit, &tree_nodes);
+  MPI_Win_lock_all(MPI_MODE_NOCHECK, tree_win);
+  tree_capacity = capacity;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Synchronization & communication
+////////////////////////////////////////////////////////////////////////////////
+template <int D>
+void SharedMemory<D>::sync() {
+  MPI_Win_sync(particles_win);
+  MPI_Win_sync(tree_win);
+  MPI_Barrier(node_comm);
+  MPI_Win_sync(particles_win);
+  MPI_Win_sync(tree_win);
+}
+
+template <int D>
+void SharedMemory<D>::exchange() {
+  if (is_leader()) {
+    MPI_Allgatherv(MPI_IN_PLACE, 0, MPI_BYTE,
+                   particles, node_counts.data(), node_displacements.data(),
+                   MPI_BYTE, leader_comm);
+  }
+}
+
+template <int D>
+bool SharedMemory<D>::share_tree(Tree<D>& tree) {
+  // The leader announces the tree size (-1 if full), so all processes can
+  // agree on reallocating the window (collective) when it is too small.
+  num_tree_nodes = tree.full() ? -1 : tree.num_nodes;
+  MPI_Bcast(&num_tree_nodes, 1, MPI_INT, 0, node_comm);
+  if (num_tree_nodes == -1) {
+    MPI_Win_unlock_all(tree_win);
+    MPI_Win_free(&tree_win);
+    allocate_tree(2 * tree_capacity);
+    tree.attach(tree_nodes, tree_capacity);
+    num_tree_nodes = 0;
+    return false;
+  }
+  sync();
+  return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Instantiations for 2D & 3D
+////////////////////////////////////////////////////////////////////////////////
+template struct SharedMemory<2>;
+template struct SharedMemory<3>;
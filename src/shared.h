@@ -0,0 +1,73 @@
+#ifndef _SHARED_H
+#define _SHARED_H
+
+#include "mpi.h"
+
+#include <vector>
+#include "particle.h"
+#include "quadtree.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// Shared memory between processes on the same node (MPI-3)
+////////////////////////////////////////////////////////////////////////////////
+//
+// All processes on a node share one particles array and one tree,
+// allocated with MPI_Win_allocate_shared on a node-local communicator.
+// Only the node leader (node_rank 0) builds the tree, and only node
+// leaders exchange particle data between nodes.
+//
+// Particles are divided so each node's processes own one contiguous block:
+// processes are ordered by (node, rank on node) and particles are divided
+// among them in that order, as in the non-shared case.
+//
+// Accesses to the windows are kept in one passive target epoch (lock_all),
+// and sync() separates the phases in which processes read or write them.
+template <int D>
+struct SharedMemory {
+  MPI_Comm comm;         // All processes
+  MPI_Comm node_comm;    // Processes on this node
+  MPI_Comm leader_comm;  // Node leaders (MPI_COMM_NULL on other processes)
+  int node_rank;         // Rank in node_comm
+  int node_size;         // Number of processes on this node
+  int node_id;           // Rank of this node's leader in leader_comm
+  int num_nodes;
+
+  int N_particles;
+  MPI_Win particles_win;
+  Particle<D>* particles; // Shared array of N_particles particles
+
+  MPI_Win tree_win;
+  TreeNode<D>* tree_nodes; // Nodes of the tree built by the leader
+  int tree_capacity;       // Number of nodes allocated in tree_win
+  int num_tree_nodes;      // Number of nodes in use
+
+  int start;  // This process calculates forces for [start, end)
+  int end;
+  // Particle blocks of each node (for node leaders), in bytes: MPI_BYTE
+  std::vector<int> node_counts;
+  std::vector<int> node_displacements;
+
+  // Collective over comm: creates the communicators & windows
+  SharedMemory(MPI_Comm comm, int N_particles);
+  SharedMemory(const SharedMemory&) = delete;
+  SharedMemory& operator=(const SharedMemory&) = delete;
+  ~SharedMemory();
+
+  bool is_leader() const { return node_rank == 0; }
+
+  // Makes writes to the windows visible to all processes on the node.
+  // [Synchronization point: barrier on node_comm]
+  void sync();
+  // Node leaders exchange the blocks of particles updated by their nodes.
+  void exchange();
+  // Shares the tree the leader built in the window (tree_nodes), and
+  // returns true. If it did not fit (full), grows the window, moves tree to
+  // it and returns false: the leader then has to rebuild it.
+  // Collective over node_comm.
+  bool share_tree(Tree<D>& tree);
+
+  private:
+  void allocate_tree(int capacity);
+};
+
+#endif // _SHARED_H
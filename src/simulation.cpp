@@ -0,0 +1,447 @@
+#include "simulation.h"
+#include "autotune.h"
+#include "io.h"
+#include <algorithm>
+#include <cstdio>
+#include <functional>
+#include <queue>
+#include <string>
+#include <utility>
+
+template <int D>
+Simulation<D>::Simulation(MPI_Comm c, const options_t& o)
+    : comm(c),
+      opts(o),
+      region(Region<double, D>::cube(0, 4)),
+      diagnostics(c, o.diagnosticsfilename, o.diagnostics_interval),
+      time(0),
+      steps_done(0),
+      diagnosed(-1),
+      io_bytes(0),
+      heartbeat_step(0),
+      heartbeat_time(0),
+      heartbeat_busy(0) {}
+
+// Returns the processes in the order of their slices' starts (the input
+// order), given the slice bounds of each (start, end), and the size of the
+// largest slice
+// In ensemble mode, the groups run their jobs (and report on stderr) at the
+// same time: messages then start with the job's output file, and are each
+// printed in one call (so lines of different jobs do not interleave)
+static std::string job_tag(const options_t& opts) {
+  if (opts.manifestfilename == nullptr) return "";
+  return "[" + std::string(opts.outputfilename) + "] ";
+}
+
+// Steps between checks of the lost particles (-L) if there are no heartbeats
+constexpr int LOST_CHECK_INTERVAL = 10;
+
+static std::vector<int> input_order(const std::vector<int>& bounds,
+                                    int* largest) {
+  int size = bounds.size() / 2;
+  std::vector<int> order(size);
+  *largest = 0;
+  for (int r = 0; r < size; ++r) {
+    order[r] = r;
+    *largest = std::max(*largest, bounds[2*r + 1] - bounds[2*r]);
+  }
+  std::sort(order.begin(), order.end(), [&](int a, int b) {
+    return bounds[2*a] < bounds[2*b];
+  });
+  return order;
+}
+
+template <int D>
+void Simulation<D>::init(const Particle<D>* particles, int N) {
+  prepare(N);
+  // Root scatters the slices (in bytes: MPI_BYTE)
+  int size; MPI_Comm_size(comm, &size);
+  std::vector<int> bounds = slice_bounds();
+  std::vector<int> counts(size);
+  std::vector<int> displacements(size);
+  for (int r = 0; r < size; ++r) {
+    counts[r] = (bounds[2*r + 1] - bounds[2*r]) * sizeof(Particle<D>);
+    displacements[r] = bounds[2*r] * sizeof(Particle<D>);
+  }
+  int rank; MPI_Comm_rank(comm, &rank);
+  std::vector<Particle<D>> slice(bounds[2*rank + 1] - bounds[2*rank]);
+  io_bytes = (double)slice.capacity() * sizeof(Particle<D>);
+  // [Synchronization point: MPI_Scatterv is blocking]
+  MPI_Scatterv(particles, counts.data(), displacements.data(), MPI_BYTE,
+               slice.data(), slice.size() * sizeof(Particle<D>), MPI_BYTE, 0,
+               comm);
+  finish_init(slice.data());
+}
+
+template <int D>
+void Simulation<D>::load(char* inputfilename) {
+  int rank; MPI_Comm_rank(comm, &rank);
+  int size; MPI_Comm_size(comm, &size);
+  std::unique_ptr<ParticleReader<D>> reader;
+  int N = 0;
+  if (rank == 0) {
+    reader = std::make_unique<ParticleReader<D>>(inputfilename);
+    N = reader->num_particles;
+  }
+  // [Synchronization point: MPI_Bcast is blocking]
+  MPI_Bcast(&N, 1, MPI_INT, 0, comm);
+  prepare(N);
+
+  // Root reads the file slice by slice (in file order: by start) into a
+  // buffer of the largest slice, and sends each to its process
+  std::vector<int> bounds = slice_bounds();
+  int largest = 0;
+  std::vector<int> order = input_order(bounds, &largest);
+  std::vector<Particle<D>> slice(bounds[2*rank + 1] - bounds[2*rank]);
+  if (rank == 0) {
+    std::vector<Particle<D>> buffer(largest);
+    for (int r : order) {
+      int count = bounds[2*r + 1] - bounds[2*r];
+      Particle<D>* dest = r == 0 ? slice.data() : buffer.data();
+      int read = reader->read(dest, count);
+      std::fill(dest + read, dest + count, Particle<D>());
+      if (r != 0) {
+        MPI_Send(buffer.data(), count * sizeof(Particle<D>), MPI_BYTE, r, 0,
+                 comm);
+      }
+    }
+    io_bytes = (double)(slice.capacity() + buffer.capacity()) *
+               sizeof(Particle<D>);
+  } else {
+    // [Synchronization point: MPI_Recv is blocking]
+    MPI_Recv(slice.data(), slice.size() * sizeof(Particle<D>), MPI_BYTE, 0,
+             0, comm, MPI_STATUS_IGNORE);
+    io_bytes = (double)slice.capacity() * sizeof(Particle<D>);
+  }
+  finish_init(slice.data());
+}
+
+template <int D>
+void Simulation<D>::write(char* outputfilename) {
+  int rank; MPI_Comm_rank(comm, &rank);
+  int size; MPI_Comm_size(comm, &size);
+  int N = num_particles();
+  if (solver->replicated()) {
+    if (rank == 0) {
+      write_file(particles(), N, outputfilename, false);
+      // write_file orders the particles by index
+      io_bytes = std::max(io_bytes, (double)N*sizeof(int));
+    }
+    return;
+  }
+  // Each process orders its slice by index, and root merges the slices in
+  // order of index, receiving them in chunks so that the chunks of all
+  // processes together take about as much memory as the largest slice
+  std::vector<int> bounds = slice_bounds();
+  int largest = 0;
+  for (int r = 0; r < size; ++r) {
+    largest = std::max(largest, bounds[2*r + 1] - bounds[2*r]);
+  }
+  int chunk = std::max(1, largest / size);
+  const Particle<D>* slice = solver->slice();
+  int count = solver->end() - solver->start();
+  std::vector<int> order = index_order(slice, count);
+  if (rank != 0) {
+    std::vector<Particle<D>> buffer(std::min(chunk, count));
+    for (int first = 0; first < count; first += chunk) {
+      int n = std::min(chunk, count - first);
+      for (int i = 0; i < n; ++i) { buffer[i] = slice[order[first + i]]; }
+      // [Synchronization point: MPI_Send may block until received]
+      MPI_Send(buffer.data(), n * sizeof(Particle<D>), MPI_BYTE, 0, 0, comm);
+    }
+    io_bytes = std::max(io_bytes, (double)buffer.capacity()*sizeof(Particle<D>)
+                                  + (double)order.capacity()*sizeof(int));
+    return;
+  }
+  std::vector<std::vector<Particle<D>>> chunks(size); // Received, by process
+  std::vector<int> used(size, 0);    // Particles of the chunk already written
+  std::vector<int> written(size, 0); // Particles of the slice already written
+  // Next particle of process r (receiving its next chunk if needed), or
+  // nullptr if all are written
+  auto next = [&](int r) -> const Particle<D>* {
+    int remaining = bounds[2*r + 1] - bounds[2*r] - written[r];
+    if (remaining == 0) { return nullptr; }
+    if (r == 0) { return &slice[order[written[0]]]; }
+    if (used[r] == (int)chunks[r].size()) {
+      chunks[r].resize(std::min(chunk, remaining));
+      // [Synchronization point: MPI_Recv is blocking]
+      MPI_Recv(chunks[r].data(), chunks[r].size() * sizeof(Particle<D>),
+               MPI_BYTE, r, 0, comm, MPI_STATUS_IGNORE);
+      used[r] = 0;
+    }
+    return &chunks[r][used[r]];
+  };
+  // Processes by the index of their next particle
+  using Head = std::pair<int, int>; // (index, process)
+  std::priority_queue<Head, std::vector<Head>, std::greater<Head>> heads;
+  for (int r = 0; r < size; ++r) {
+    const Particle<D>* p = next(r);
+    if (p) { heads.push({p->index, r}); }
+  }
+  ParticleWriter<D> writer(outputfilename, N, false);
+  while (!heads.empty()) {
+    int r = heads.top().second;
+    heads.pop();
+    writer.write(next(r), 1);
+    ++written[r];
+    ++used[r];
+    const Particle<D>* p = next(r);
+    if (p) { heads.push({p->index, r}); }
+  }
+  double buffers = (double)order.capacity()*sizeof(int);
+  for (int r = 0; r < size; ++r) {
+    buffers += (double)chunks[r].capacity()*sizeof(Particle<D>);
+  }
+  io_bytes = std::max(io_bytes, buffers);
+}
+
+template <int D>
+void Simulation<D>::prepare(int N) {
+  if (!solver) { solver = make_solver(opts, comm, N, region); }
+  if (!integrator) {
+    integrator = std::make_unique<ConstantAccelerationIntegrator<D>>();
+  }
+}
+
+template <int D>
+std::vector<int> Simulation<D>::slice_bounds() {
+  int size; MPI_Comm_size(comm, &size);
+  std::vector<int> bounds(2*size);
+  int local[2] = {solver->start(), solver->end()};
+  MPI_Allgather(local, 2, MPI_INT, bounds.data(), 2, MPI_INT, comm);
+  return bounds;
+}
+
+template <int D>
+void Simulation<D>::finish_init(const Particle<D>* slice) {
+  solver->init(slice);
+  forces.resize(solver->end() - solver->start());
+  if (opts.error_target > 0 && !solver->autotune(opts.error_target)) {
+    int rank; MPI_Comm_rank(comm, &rank);
+    if (rank == 0) {
+      fprintf(stderr, "%sWarning: -A ignored: the %s engine is exact (no "
+              "theta to tune)\n", job_tag(opts).c_str(), solver->name());
+    }
+  }
+  heartbeat_step = steps_done;
+  heartbeat_time = MPI_Wtime();
+}
+
+template <int D>
+void Simulation<D>::step(int n) {
+  for (int s = 0; s < n; ++s) {
+    // 0. Periodically sort the particles along the Morton curve, as they
+    // move (for memory locality & spatially compact slices)
+    int interval = opts.reorder_interval;
+    if (interval > 0 && steps_done % interval == 0) {
+      solver->reorder(profile);
+    }
+
+    // 1. Get the particles updated by other processes (e.g. build the tree)
+    solver->begin_step(profile);
+
+    // Diagnostics for the state at the start of the step
+    if (diagnostics.due(steps_done) && diagnosed != steps_done) {
+      double t0 = MPI_Wtime();
+      diagnostics.record(steps_done, time, solver->calc_diagnostics(profile));
+      profile.t_diag += MPI_Wtime() - t0;
+      diagnosed = steps_done;
+    }
+
+    // 2. All processes calculate forces for their section of particles
+    // (communication inside the solver is counted as exposed wait, not force)
+    double t0 = MPI_Wtime();
+    double wait = profile.t_wait;
+    solver->calc_forces(forces.data(), profile);
+    double t1 = MPI_Wtime();
+    profile.t_force += t1 - t0 - (profile.t_wait - wait);
+
+    // 3. All processes update their section of particles
+    double dt = timestep();
+    int blown_up = integrator->update(solver->slice(), forces.data(),
+                                      solver->end() - solver->start(), dt);
+    if (blown_up > 0) { abort_blown_up(blown_up); }
+    time += dt;
+    steps_done++;
+    profile.t_update += MPI_Wtime() - t1;
+
+    // 4. Start sending the updated section to the other processes
+    solver->end_step(profile);
+
+    // Progress & health report (without one, the lost particles are still
+    // checked if -L is given)
+    int k = opts.heartbeat_interval;
+    if (k > 0) {
+      if (steps_done % k == 0) { heartbeat(); }
+    } else if (opts.max_lost_fraction < 1 &&
+               steps_done % LOST_CHECK_INTERVAL == 0) {
+      int lost = count_lost();
+      int total = 0;
+      MPI_Reduce(&lost, &total, 1, MPI_INT, MPI_SUM, 0, comm);
+      check_lost(total);
+    }
+  }
+  solver->synchronize(profile);
+}
+
+template <int D>
+void Simulation<D>::abort_blown_up(int blown_up) {
+  // A non-finite particle makes the forces on all others non-finite from the
+  // next step on: stop all processes now (the others may be waiting for
+  // this one in a collective)
+  int rank; MPI_Comm_rank(comm, &rank);
+  fprintf(stderr, "%sError: %d particles of process %d are not finite after "
+          "step %d (the simulation blew up): aborting.\n",
+          job_tag(opts).c_str(), blown_up, rank, steps_done + 1);
+  MPI_Abort(comm, EXIT_FAILURE);
+}
+
+template <int D>
+void Simulation<D>::heartbeat() {
+  int rank; MPI_Comm_rank(comm, &rank);
+  int size; MPI_Comm_size(comm, &size);
+  // Busy (not waiting) time of this process since the last heartbeat, and
+  // its lost particles
+  const Profile& p = profile;
+  double busy = p.t_build + p.t_force + p.t_update + p.t_diag;
+  double interval_busy = busy - heartbeat_busy;
+  heartbeat_busy = busy;
+  double local[2] = {interval_busy, (double)count_lost()};
+  double sums[2] = {0, 0};
+  double max_busy = 0;
+  MPI_Reduce(local, sums, 2, MPI_DOUBLE, MPI_SUM, 0, comm);
+  MPI_Reduce(&interval_busy, &max_busy, 1, MPI_DOUBLE, MPI_MAX, 0, comm);
+
+  double now = MPI_Wtime();
+  double rate = (steps_done - heartbeat_step)/(now - heartbeat_time);
+  heartbeat_step = steps_done;
+  heartbeat_time = now;
+  if (rank == 0) {
+    // Skew: slowest process' busy time over the mean (1: balanced)
+    double mean_busy = sums[0]/size;
+    double skew = (mean_busy > 0 ? max_busy/mean_busy : 1);
+    int N = num_particles();
+    char progress[64];
+    if (opts.steps > steps_done) {
+      snprintf(progress, sizeof(progress), "/%d, %.1f steps/s, ETA %.1f s",
+               opts.steps, rate, (opts.steps - steps_done)/rate);
+    } else {
+      snprintf(progress, sizeof(progress), ", %.1f steps/s", rate);
+    }
+    fprintf(stderr, "%sHeartbeat: step %d%s, step time skew (max/mean over %d "
+            "processes) %.2f, lost %.0f/%d particles\n", job_tag(opts).c_str(),
+            steps_done, progress, size, skew, sums[1], N);
+  }
+  check_lost(sums[1]);
+}
+
+template <int D>
+int Simulation<D>::count_lost() {
+  const Particle<D>* slice = solver->slice();
+  int lost = 0;
+  for (int i = 0; i < solver->end() - solver->start(); ++i) {
+    if (slice[i].mass == -1 || !isContained(slice[i], region)) { lost++; }
+  }
+  return lost;
+}
+
+template <int D>
+void Simulation<D>::check_lost(double lost) {
+  int rank; MPI_Comm_rank(comm, &rank);
+  if (rank != 0 || lost <= opts.max_lost_fraction*num_particles()) return;
+  fprintf(stderr, "%sError: more than %g of the particles are lost "
+          "(%.0f/%d after step %d): aborting.\n", job_tag(opts).c_str(),
+          opts.max_lost_fraction, lost, num_particles(), steps_done);
+  MPI_Abort(comm, EXIT_FAILURE);
+}
+
+template <int D>
+void Simulation<D>::record_diagnostics() {
+  if (!diagnostics.due(steps_done) || diagnosed == steps_done) return;
+  solver->begin_step(profile);
+  double t0 = MPI_Wtime();
+  diagnostics.record(steps_done, time, solver->calc_diagnostics(profile));
+  profile.t_diag += MPI_Wtime() - t0;
+  diagnosed = steps_done;
+}
+
+template <int D>
+double Simulation<D>::timestep() {
+  if (opts.adaptive_eta <= 0) return opts.dt;
+  return adaptive_timestep(solver->slice(), forces.data(),
+                           solver->end() - solver->start(), opts.adaptive_eta,
+                           opts.softening, opts.dt, comm);
+}
+
+template <int D>
+void Simulation<D>::print_profile() {
+  int rank; MPI_Comm_rank(comm, &rank);
+  int size; MPI_Comm_size(comm, &size);
+  const Profile& p = profile;
+  double local[5] = {p.t_wait, p.t_build, p.t_force, p.t_update, p.t_diag};
+  double max[5] = {0, 0, 0, 0, 0};
+  MPI_Reduce(local, max, 5, MPI_DOUBLE, MPI_MAX, 0, comm);
+  int local_counts[2] = {p.slices_waited, p.slices_ready};
+  int total_counts[2] = {0, 0};
+  MPI_Reduce(local_counts, total_counts, 2, MPI_INT, MPI_SUM, 0, comm);
+  long long local_walks[3] = {p.node_visits, p.interactions,
+                              p.particles_walked};
+  long long total_walks[3] = {0, 0, 0};
+  MPI_Reduce(local_walks, total_walks, 3, MPI_LONG_LONG, MPI_SUM, 0, comm);
+  if (rank == 0) {
+    int steps = std::max(steps_done, 1);
+    printf("Profile (%s engine, max over %d processes, ms/step):\n",
+           solver->name(), size);
+    printf("\twait (exposed comm.): %f\n", 1e3*max[0]/steps);
+    printf("\tbuild tree:           %f\n", 1e3*max[1]/steps);
+    printf("\tcalc forces:          %f\n", 1e3*max[2]/steps);
+    printf("\tupdate particles:     %f\n", 1e3*max[3]/steps);
+    printf("\tdiagnostics:          %f\n", 1e3*max[4]/steps);
+    // Only for solvers that overlap slice broadcasts with tree construction
+    if (total_counts[0] > 0) {
+      printf("\tslices already received when needed: %d/%d (%.1f%%)\n",
+             total_counts[1], total_counts[0],
+             100.0*total_counts[1]/total_counts[0]);
+    }
+    // Only for solvers that walk a tree
+    if (total_walks[2] > 0) {
+      printf("\ttree walks (groups of up to %d particles), per particle:\n"
+             "\t\tnode visits: %.1f, interactions: %.1f\n",
+             opts.walk_group_size, (double)total_walks[0]/total_walks[2],
+             (double)total_walks[1]/total_walks[2]);
+    }
+  }
+}
+
+template <int D>
+void Simulation<D>::print_memory() {
+  int rank; MPI_Comm_rank(comm, &rank);
+  int size; MPI_Comm_size(comm, &size);
+  std::vector<MemoryUse> uses = solver->memory();
+  uses.push_back({"forces",
+                  (double)forces.capacity() * sizeof(Vec<double, D>)});
+  uses.push_back({"input/output buffers", io_bytes});
+  // Per structure, and the total of each process
+  std::vector<double> local(uses.size() + 1, 0);
+  for (size_t i = 0; i < uses.size(); ++i) {
+    local[i] = uses[i].bytes;
+    local.back() += uses[i].bytes;
+  }
+  std::vector<double> max(local.size(), 0);
+  MPI_Reduce(local.data(), max.data(), local.size(), MPI_DOUBLE, MPI_MAX, 0,
+             comm);
+  if (rank == 0) {
+    printf("Memory (%d particles, max over %d processes, MB):\n",
+           num_particles(), size);
+    for (size_t i = 0; i < uses.size(); ++i) {
+      printf("\t%-36s %10.3f\n", uses[i].name, max[i]/1e6);
+    }
+    printf("\t%-36s %10.3f\n", "total (peak, at most)", max.back()/1e6);
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Instantiations for 2D & 3D
+////////////////////////////////////////////////////////////////////////////////
+template struct Simulation<2>;
+template struct Simulation<3>;
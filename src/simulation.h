@@ -0,0 +1,129 @@
+#ifndef _SIMULATION_H
+#define _SIMULATION_H
+
+#include "mpi.h"
+
+#include <memory>
+#include <vector>
+#include "argparse.h"
+#include "diagnostics.h"
+#include "integrator.h"
+#include "particle.h"
+#include "quadtree.h"
+#include "solver.h"
+#include "vector.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// Simulation (library entry point)
+////////////////////////////////////////////////////////////////////////////////
+//
+// An N-body simulation in D dimensions on the processes of a communicator,
+// configured by options_t (as parsed from the command line, or filled in by
+// the caller: see set_default_opts). All members are collective over comm.
+//
+//   Simulation<2> sim(comm, opts);
+//   sim.init(particles, N);   // particles only read on process 0
+//                             // (or sim.load(filename))
+//   sim.step(100);
+//   Particle<2>* p = sim.particles();
+//
+// The particles live in the solver's storage: particles() points to all N
+// of them, current on every process after init() and step(), if the solver
+// is replicated (tree engines), and otherwise only to this process' slice
+// (direct engine). They can be read and modified in place between steps
+// (no copies); modifications of replicated particles must be made
+// identically on every process (with node shared memory the array is
+// shared by the processes of a node), and are used from the next step.
+// Every reorder_interval (-r) steps, step() sorts the array along the Morton
+// curve: identify particles by their index, not their position in it.
+//
+// load() and write() stream the particles between a file and the slices
+// through process 0, so with the direct engine no process ever holds more
+// than its slice and one other slice (N may exceed one process' memory).
+//
+// The solver (force calculation & data distribution) and the integrator can
+// be replaced by assigning solver & integrator before init(). By default,
+// the solver is chosen by the options (make_solver) and the integrator is
+// ConstantAccelerationIntegrator.
+template <int D>
+struct Simulation {
+  MPI_Comm comm;
+  options_t opts;
+  // Square/cubic region (0<=x,y(,z)<=4) outside of which particles are lost
+  const Region<double, D> region;
+  std::unique_ptr<Solver<D>> solver;
+  std::unique_ptr<Integrator<D>> integrator;
+
+  // Energy & momentum diagnostics, recorded every k steps (if enabled) for
+  // the state at the start of a step.
+  DiagnosticsLog<D> diagnostics;
+  Profile profile;
+  double time;       // Simulated time (steps may have different dt)
+  int steps_done;
+  int diagnosed;     // Last step whose state diagnostics were recorded for
+  std::vector<Vec<double, D>> forces; // On this process' slice
+  double io_bytes;   // Peak size of the buffers of init(), load() & write()
+  // Step, wall time (on this process) & busy time at the last heartbeat
+  int heartbeat_step;
+  double heartbeat_time;
+  double heartbeat_busy;
+
+  Simulation(MPI_Comm comm, const options_t& opts);
+  Simulation(const Simulation&) = delete;
+  Simulation& operator=(const Simulation&) = delete;
+
+  // Distributes the N particles (only read on process 0), and autotunes
+  // theta if an error target is given.
+  void init(const Particle<D>* particles, int N);
+  // Reads the particles from a file (see io.h) on process 0, sending each
+  // process its slice, and autotunes theta as init() does.
+  void load(char* inputfilename);
+  // Advances all particles by n steps. Every heartbeat_interval (-H) steps,
+  // process 0 prints the progress to stderr (see heartbeat()). Aborts all
+  // processes (MPI_Abort) if a particle blows up (its position or velocity
+  // is not finite), or if more than max_lost_fraction (-L) of the particles
+  // are lost at a heartbeat (or every LOST_CHECK_INTERVAL steps, without
+  // heartbeats).
+  void step(int n = 1);
+  // Records diagnostics for the current state, if they are due (step()
+  // records them at the start of each step: call this after the last step
+  // to also record the final state).
+  void record_diagnostics();
+
+  // Writes all particles to a file (see io.h) on process 0, in order of
+  // their index (as write_file() does, for any engine), merging the slices
+  // received in chunks if the solver isn't replicated
+  void write(char* outputfilename);
+
+  Particle<D>* particles() { return solver->particles(); }
+  int num_particles() const { return solver->num_particles(); }
+
+  // Prints per-step phase times (max over processes) on process 0
+  void print_profile();
+  // Prints the memory used by each data structure, and the total (max over
+  // processes) on process 0
+  void print_memory();
+
+  private:
+  // Creates the solver & integrator (unless assigned) for N particles
+  void prepare(int N);
+  // Each process' slice bounds: (start, end) of rank r at [2r], [2r + 1]
+  std::vector<int> slice_bounds();
+  // Initializes the solver from this process' slice, and autotunes theta
+  void finish_init(const Particle<D>* slice);
+  // Reports the steps/s since the last heartbeat, the ETA (of opts.steps),
+  // the skew of the processes' busy time & the lost particles (collective)
+  void heartbeat();
+  // Reports the blown_up particles of this process, and aborts all
+  void abort_blown_up(int blown_up);
+  // Number of this process' lost particles (marked, or outside the region &
+  // not yet marked)
+  int count_lost();
+  // Aborts all processes if the lost particles of all processes exceed
+  // max_lost_fraction of them (lost: total, only used on process 0)
+  void check_lost(double lost);
+  // Timestep for the slice & its forces: fixed, or adaptive (if eta is given)
+  double timestep();
+};
+
+#endif // _SIMULATION_H
@@ -0,0 +1,487 @@
+#include "solver.h"
+#include "autotune.h"
+#include "physics.h"
+#include <algorithm>
+
+// Particles inserted into the tree between tests of the outstanding slice
+// broadcasts
+constexpr int PROGRESS_INTERVAL = 1024;
+
+static int comm_rank(MPI_Comm comm) {
+  int rank; MPI_Comm_rank(comm, &rank);
+  return rank;
+}
+
+static int comm_size(MPI_Comm comm) {
+  int size; MPI_Comm_size(comm, &size);
+  return size;
+}
+
+// Divides N particles among size processes, in units of unit particles
+// (the last unit may be partial): process i gets [first[i], first[i + 1]).
+// The first (number of units) % size processes get 1 extra unit.
+static std::vector<int> divide(int N, int size, int unit = 1) {
+  std::vector<int> first(size + 1, 0);
+  int units = (N + unit - 1) / unit;
+  int q = units / size;
+  int r = units % size;
+  for (int i = 0; i < size; ++i) {
+    first[i + 1] = first[i] + q + (i < r ? 1 : 0);
+  }
+  for (int& f : first) { f = std::min(f*unit, N); }
+  return first;
+}
+
+// Number of particles of each process (as divided by divide())
+static std::vector<int> slice_sizes(int N, int size, int unit = 1) {
+  std::vector<int> first = divide(N, size, unit);
+  std::vector<int> sizes(size);
+  for (int i = 0; i < size; ++i) { sizes[i] = first[i + 1] - first[i]; }
+  return sizes;
+}
+
+// Bytes allocated for a vector
+template <typename T>
+static double bytes(const std::vector<T>& v) {
+  return (double)v.capacity() * sizeof(T);
+}
+
+// Adds the counters of the walk's last force calculation to profile
+template <typename Walk>
+static void add_walk_counters(const Walk& walk, Profile& profile) {
+  profile.node_visits += walk.node_visits;
+  profile.interactions += walk.interactions;
+  profile.particles_walked += walk.particles_walked;
+}
+
+// Returns the solver for the engine chosen by opts, with the given kernel
+template <int D, typename Kernel>
+static std::unique_ptr<Solver<D>> make_solver(const options_t& opts,
+                                              MPI_Comm comm, int N,
+                                              const Region<double, D>& region,
+                                              const Kernel& kernel) {
+  // For few particles, the exact direct summation is cheaper than building
+  // and traversing a tree (and needs no per-step broadcast).
+  bool use_direct = (opts.engine == Engine::Direct) ||
+                    (opts.engine == Engine::Auto && N < opts.direct_threshold);
+  if (use_direct) {
+    return std::make_unique<DirectSolver<D, Kernel>>(comm, N, region, kernel,
+                                                     opts.reproducible);
+  }
+  // With node shared memory (tree engine only), all processes on a node
+  // use a single shared particles array instead of their own vectors.
+  if (opts.shared_memory) {
+    return std::make_unique<SharedTreeSolver<D, Kernel>>(
+        comm, N, region, opts.theta, kernel, opts.walk_group_size,
+        opts.reproducible);
+  }
+  return std::make_unique<TreeSolver<D, Kernel>>(
+      comm, N, region, opts.theta, kernel, opts.walk_group_size,
+      opts.reproducible);
+}
+
+template <int D>
+std::unique_ptr<Solver<D>> make_solver(const options_t& opts, MPI_Comm comm,
+                                       int N, const Region<double, D>& region) {
+  double eps = opts.softening;
+  switch (opts.force_law) {
+    case ForceLaw::Plummer:
+      return make_solver(opts, comm, N, region, PlummerKernel{eps});
+    case ForceLaw::Spline:
+      return make_solver(opts, comm, N, region, SplineKernel{eps});
+    case ForceLaw::Cutoff:
+      return make_solver(opts, comm, N, region,
+                         CutoffKernel{eps, opts.cutoff_radius});
+    case ForceLaw::Clamp:
+    default:
+      return make_solver(opts, comm, N, region, ClampKernel{eps});
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Tree solver
+////////////////////////////////////////////////////////////////////////////////
+template <int D, typename Kernel>
+TreeSolver<D, Kernel>::TreeSolver(MPI_Comm c, int N,
+                                  const Region<double, D>& r, double t,
+                                  const Kernel& k, int g, bool reproducible)
+    : comm(c),
+      rank(comm_rank(c)),
+      size(comm_size(c)),
+      region(r),
+      theta(t),
+      walk(k, g, reproducible),
+      all(N),
+      starts(size),
+      ends(size),
+      counts(size),
+      displacements(size),
+      tree(r),
+      autotune_bytes(0),
+      requests(size, MPI_REQUEST_NULL),
+      completed(size),
+      slices_pending(false) {
+  std::vector<int> first = divide(N, size);
+  for (int i = 0; i < size; ++i) {
+    starts[i] = first[i];
+    ends[i] = first[i + 1];
+    counts[i] = (ends[i] - starts[i]) * sizeof(Particle<D>);
+    displacements[i] = starts[i] * sizeof(Particle<D>);
+  }
+  potentials.resize(ends[rank] - starts[rank]);
+}
+
+template <int D, typename Kernel>
+void TreeSolver<D, Kernel>::init(const Particle<D>* slice) {
+  std::copy(slice, slice + (end() - start()), &all[start()]);
+  // [Synchronization point: MPI_Allgatherv is blocking]
+  // This is the only full exchange. Afterwards each process only sends the
+  // slice it updated, so no process has to wait for root to gather
+  // everything.
+  MPI_Allgatherv(MPI_IN_PLACE, 0, MPI_BYTE,
+                 all.data(), counts.data(), displacements.data(), MPI_BYTE,
+                 comm);
+}
+
+template <int D, typename Kernel>
+std::vector<MemoryUse> TreeSolver<D, Kernel>::memory() const {
+  return {{"particles (all)", bytes(all)},
+          {"tree", tree.bytes()},
+          {"tree walks", walk.bytes()},
+          {"reorder buffer", bytes(sort_keys)},
+          {"autotune (temporary)", autotune_bytes},
+          {"diagnostics", bytes(potentials)}};
+}
+
+template <int D, typename Kernel>
+bool TreeSolver<D, Kernel>::autotune(double error_target) {
+  theta = autotune_theta(all.data(), all.size(), start(), end(), region,
+                         walk, error_target, theta, comm, &autotune_bytes);
+  return true;
+}
+
+template <int D, typename Kernel>
+void TreeSolver<D, Kernel>::reorder(Profile& profile) {
+  // Every process sorts its copy of all particles (identical once all
+  // slices are received, so the processes agree on the order)
+  synchronize(profile);
+  double t0 = MPI_Wtime();
+  morton_sort(all.data(), all.size(), region, sort_keys);
+  profile.t_build += MPI_Wtime() - t0;
+}
+
+template <int D, typename Kernel>
+void TreeSolver<D, Kernel>::begin_step(Profile& profile) {
+  tree.clear();
+  // Insert particles, one slice at a time, waiting for each slice's
+  // broadcast from the previous step to complete first.
+  // Particles that move outside the region are "lost".
+  // They are not inserted into the tree and their mass is set to m = -1
+  // Subsequent stages check for m = -1 to ignore lost particles.
+  // Note: a process must also wait for its own slice before inserting,
+  // because insert may write to it (m = -1) while it is a send buffer.
+  // A slice counts as ready if an earlier test (between insertions) found
+  // its broadcast complete.
+  if (slices_pending) { progress(); }
+  for (int r = 0; r < size; ++r) {
+    if (slices_pending) {
+      double t0 = MPI_Wtime();
+      bool ready = (requests[r] == MPI_REQUEST_NULL);
+      MPI_Wait(&requests[r], MPI_STATUS_IGNORE);
+      profile.t_wait += MPI_Wtime() - t0;
+      profile.slices_waited++;
+      profile.slices_ready += ready;
+    }
+    double t0 = MPI_Wtime();
+    for (int i = starts[r]; i < ends[r]; ++i) {
+      tree.insert(all[i]);
+      if (slices_pending && (i - starts[r]) % PROGRESS_INTERVAL == 0) {
+        progress();
+      }
+    }
+    profile.t_build += MPI_Wtime() - t0;
+  }
+  slices_pending = false;
+}
+
+template <int D, typename Kernel>
+void TreeSolver<D, Kernel>::progress() {
+  int count = 0;
+  MPI_Testsome(size, requests.data(), &count, completed.data(),
+               MPI_STATUSES_IGNORE);
+}
+
+template <int D, typename Kernel>
+void TreeSolver<D, Kernel>::calc_forces(Vec<double, D>* forces,
+                                        Profile& profile) {
+  walk.calc_net_forces(all.data(), all.size(), start(), end(),
+                       tree.nodes, tree.num_nodes, theta, forces);
+  add_walk_counters(walk, profile);
+}
+
+template <int D, typename Kernel>
+PartialDiagnostics<D> TreeSolver<D, Kernel>::calc_diagnostics(Profile&) {
+  for (int i = start(); i < end(); ++i) {
+    potentials[i - start()] = calc_potential(all[i], tree.nodes,
+                                             tree.num_nodes, theta,
+                                             walk.kernel);
+  }
+  return ::calc_diagnostics(&all[start()], end() - start(),
+                            potentials.data());
+}
+
+template <int D, typename Kernel>
+void TreeSolver<D, Kernel>::end_step(Profile&) {
+  // Start broadcasting updated slices: process r is the root of the r-th
+  // broadcast. [Not a synchronization point: MPI_Ibcast is nonblocking]
+  // Completion is waited on slice by slice in the next begin_step.
+  for (int r = 0; r < size; ++r) {
+    MPI_Ibcast(&all.data()[starts[r]], counts[r], MPI_BYTE, r, comm,
+               &requests[r]);
+  }
+  slices_pending = true;
+}
+
+template <int D, typename Kernel>
+void TreeSolver<D, Kernel>::synchronize(Profile& profile) {
+  if (!slices_pending) return;
+  double t0 = MPI_Wtime();
+  MPI_Waitall(size, requests.data(), MPI_STATUSES_IGNORE);
+  profile.t_wait += MPI_Wtime() - t0;
+  slices_pending = false;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Shared tree solver
+////////////////////////////////////////////////////////////////////////////////
+template <int D, typename Kernel>
+SharedTreeSolver<D, Kernel>::SharedTreeSolver(MPI_Comm comm, int N,
+                                              const Region<double, D>& r,
+                                              double t, const Kernel& k,
+                                              int g, bool reproducible)
+    : region(r),
+      theta(t),
+      walk(k, g, reproducible),
+      shared(comm, N),
+      tree(r, shared.tree_nodes, shared.tree_capacity),
+      autotune_bytes(0),
+      exchange_pending(false) {
+  potentials.resize(shared.end - shared.start);
+}
+
+template <int D, typename Kernel>
+void SharedTreeSolver<D, Kernel>::init(const Particle<D>* slice) {
+  // Each process writes its slice into its node's array, then node leaders
+  // exchange the nodes' blocks
+  std::copy(slice, slice + (end() - start()), &shared.particles[start()]);
+  shared.sync();
+  shared.exchange();
+  shared.sync();
+}
+
+template <int D, typename Kernel>
+std::vector<MemoryUse> SharedTreeSolver<D, Kernel>::memory() const {
+  // The shared windows are allocated by the node leader
+  bool leader = shared.is_leader();
+  double particles = leader ? (double)shared.N_particles*sizeof(Particle<D>)
+                            : 0;
+  double shared_tree = leader ? (double)shared.tree_capacity*
+                                sizeof(TreeNode<D>) : 0;
+  return {{"particles (all, shared by the node)", particles},
+          {"tree (shared by the node)", shared_tree},
+          {"tree walks", walk.bytes()},
+          {"reorder buffer", bytes(sort_keys)},
+          {"autotune (temporary)", autotune_bytes},
+          {"diagnostics", bytes(potentials)}};
+}
+
+template <int D, typename Kernel>
+bool SharedTreeSolver<D, Kernel>::autotune(double error_target) {
+  theta = autotune_theta(shared.particles, shared.N_particles, start(), end(),
+                         region, walk, error_target, theta, shared.comm,
+                         &autotune_bytes);
+  return true;
+}
+
+template <int D, typename Kernel>
+void SharedTreeSolver<D, Kernel>::reorder(Profile& profile) {
+  // Node leaders sort their node's array (identical on all nodes after the
+  // exchange), while the other processes of the node wait
+  synchronize(profile);
+  double t0 = MPI_Wtime();
+  shared.sync();
+  double t1 = MPI_Wtime();
+  if (shared.is_leader()) {
+    morton_sort(shared.particles, shared.N_particles, region, sort_keys);
+  }
+  double t2 = MPI_Wtime();
+  shared.sync();
+  profile.t_build += t2 - t1;
+  profile.t_wait += (t1 - t0) + (MPI_Wtime() - t2);
+}
+
+template <int D, typename Kernel>
+void SharedTreeSolver<D, Kernel>::begin_step(Profile& profile) {
+  // 1. Node leaders exchange the blocks updated by their nodes (otherwise,
+  // make changes to the particles since the last step visible on the node)
+  double t0 = MPI_Wtime();
+  if (exchange_pending) {
+    shared.exchange();
+    exchange_pending = false;
+  } else {
+    shared.sync();
+  }
+  double t1 = MPI_Wtime();
+  profile.t_wait += t1 - t0;
+
+  // 2. Node leaders construct the tree in the shared window (rebuilt if the
+  // window had to grow), then share it with their node
+  // Particles that move outside the region are "lost" (m = -1)
+  bool shared_tree = false;
+  while (!shared_tree) {
+    t0 = MPI_Wtime();
+    if (shared.is_leader()) {
+      tree.clear();
+      for (int i = 0; i < shared.N_particles; ++i) {
+        tree.insert(shared.particles[i]);
+      }
+    }
+    t1 = MPI_Wtime();
+    shared_tree = shared.share_tree(tree);
+    profile.t_build += t1 - t0;
+    profile.t_wait += MPI_Wtime() - t1;
+  }
+}
+
+template <int D, typename Kernel>
+void SharedTreeSolver<D, Kernel>::calc_forces(Vec<double, D>* forces,
+                                              Profile& profile) {
+  walk.calc_net_forces(shared.particles, shared.N_particles, start(), end(),
+                       shared.tree_nodes, shared.num_tree_nodes, theta,
+                       forces);
+  add_walk_counters(walk, profile);
+  // Fixed groups also read particles of the neighboring slices: they must
+  // not be updated (in place) before all processes of the node are done
+  if (walk.fixed_groups) {
+    double t0 = MPI_Wtime();
+    shared.sync();
+    profile.t_wait += MPI_Wtime() - t0;
+  }
+}
+
+template <int D, typename Kernel>
+PartialDiagnostics<D> SharedTreeSolver<D, Kernel>::calc_diagnostics(Profile&) {
+  for (int i = start(); i < end(); ++i) {
+    potentials[i - start()] = calc_potential(shared.particles[i],
+                                             shared.tree_nodes,
+                                             shared.num_tree_nodes, theta,
+                                             walk.kernel);
+  }
+  return ::calc_diagnostics(&shared.particles[start()], end() - start(),
+                            potentials.data());
+}
+
+template <int D, typename Kernel>
+void SharedTreeSolver<D, Kernel>::end_step(Profile& profile) {
+  // Wait for all processes on the node to finish their updates
+  double t0 = MPI_Wtime();
+  shared.sync();
+  profile.t_wait += MPI_Wtime() - t0;
+  exchange_pending = true;
+}
+
+template <int D, typename Kernel>
+void SharedTreeSolver<D, Kernel>::synchronize(Profile& profile) {
+  if (!exchange_pending) return;
+  double t0 = MPI_Wtime();
+  shared.exchange();
+  shared.sync();
+  profile.t_wait += MPI_Wtime() - t0;
+  exchange_pending = false;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Direct solver
+////////////////////////////////////////////////////////////////////////////////
+template <int D, typename Kernel>
+DirectSolver<D, Kernel>::DirectSolver(MPI_Comm c, int N,
+                                      const Region<double, D>& r,
+                                      const Kernel& k, bool reproducible)
+    : comm(c),
+      rank(comm_rank(c)),
+      size(comm_size(c)),
+      region(r),
+      N_particles(N),
+      starts(size),
+      ends(size),
+      direct(c, slice_sizes(N, size, reproducible ? TILE_SOURCES : 1), k,
+             reproducible) {
+  std::vector<int> first = divide(N, size, reproducible ? TILE_SOURCES : 1);
+  for (int i = 0; i < size; ++i) {
+    starts[i] = first[i];
+    ends[i] = first[i + 1];
+  }
+  local.resize(ends[rank] - starts[rank]);
+  potentials.resize(ends[rank] - starts[rank]);
+}
+
+template <int D, typename Kernel>
+void DirectSolver<D, Kernel>::init(const Particle<D>* slice) {
+  std::copy(slice, slice + local.size(), local.begin());
+}
+
+template <int D, typename Kernel>
+std::vector<MemoryUse> DirectSolver<D, Kernel>::memory() const {
+  return {{"particles (slice)", bytes(local)},
+          {"ring buffers", direct.bytes()},
+          {"diagnostics", bytes(potentials)}};
+}
+
+template <int D, typename Kernel>
+void DirectSolver<D, Kernel>::calc_forces(Vec<double, D>* forces,
+                                          Profile& profile) {
+  // Communication in the ring is counted as exposed wait
+  double ring_wait = direct.t_wait;
+  direct.calc_net_forces(local.data(), local.size(), region, forces);
+  profile.t_wait += direct.t_wait - ring_wait;
+}
+
+template <int D, typename Kernel>
+PartialDiagnostics<D> DirectSolver<D, Kernel>::calc_diagnostics(Profile&) {
+  // Potentials from another pass around the ring
+  direct.calc_potentials(local.data(), local.size(), region,
+                         potentials.data());
+  return ::calc_diagnostics(local.data(), local.size(), potentials.data());
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Instantiations for 2D & 3D, and each kernel
+////////////////////////////////////////////////////////////////////////////////
+template std::unique_ptr<Solver<2>> make_solver(const options_t&, MPI_Comm,
+                                                int, const Region<double, 2>&);
+template std::unique_ptr<Solver<3>> make_solver(const options_t&, MPI_Comm,
+                                                int, const Region<double, 3>&);
+template struct TreeSolver<2, ClampKernel>;
+template struct TreeSolver<2, PlummerKernel>;
+template struct TreeSolver<2, SplineKernel>;
+template struct TreeSolver<2, CutoffKernel>;
+template struct TreeSolver<3, ClampKernel>;
+template struct TreeSolver<3, PlummerKernel>;
+template struct TreeSolver<3, SplineKernel>;
+template struct TreeSolver<3, CutoffKernel>;
+template struct SharedTreeSolver<2, ClampKernel>;
+template struct SharedTreeSolver<2, PlummerKernel>;
+template struct SharedTreeSolver<2, SplineKernel>;
+template struct SharedTreeSolver<2, CutoffKernel>;
+template struct SharedTreeSolver<3, ClampKernel>;
+template struct SharedTreeSolver<3, PlummerKernel>;
+template struct SharedTreeSolver<3, SplineKernel>;
+template struct SharedTreeSolver<3, CutoffKernel>;
+template struct DirectSolver<2, ClampKernel>;
+template struct DirectSolver<2, PlummerKernel>;
+template struct DirectSolver<2, SplineKernel>;
+template struct DirectSolver<2, CutoffKernel>;
+template struct DirectSolver<3, ClampKernel>;
+template struct DirectSolver<3, PlummerKernel>;
+template struct DirectSolver<3, SplineKernel>;
+template struct DirectSolver<3, CutoffKernel>;
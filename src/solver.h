@@ -0,0 +1,268 @@
+#ifndef _SOLVER_H
+#define _SOLVER_H
+
+#include "mpi.h"
+
+#include <memory>
+#include <vector>
+#include "argparse.h"
+#include "diagnostics.h"
+#include "direct.h"
+#include "kernels.h"
+#include "particle.h"
+#include "quadtree.h"
+#include "shared.h"
+#include "vector.h"
+#include "walk.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// Profile
+////////////////////////////////////////////////////////////////////////////////
+// Time spent in each phase of the steps (per process, accumulated)
+struct Profile {
+  double t_wait = 0;     // blocked waiting for communication (exposed comm.)
+  double t_build = 0;    // inserting particles into the tree (& reordering)
+  double t_force = 0;    // calculating forces for this process' slice
+  double t_update = 0;   // updating positions & velocities of the slice
+  double t_diag = 0;     // calculating & recording diagnostics
+  int slices_waited = 0; // slices whose broadcast was waited on
+  int slices_ready = 0;  // ...of which had completed before being waited on
+                         // (fully hidden)
+  long long node_visits = 0;      // tree nodes visited by force walks
+  long long interactions = 0;     // particle-node interactions summed
+  long long particles_walked = 0; // particles whose forces were walked for
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Memory footprint
+////////////////////////////////////////////////////////////////////////////////
+// Memory used by one data structure on this process, at its peak. Most
+// buffers are only grown (and reused by later steps), so their current size
+// is their peak; temporary ones (e.g. of autotune) report the largest size
+// they had. Their sum bounds the peak of the process from above, as the
+// temporary buffers are not all allocated at once.
+struct MemoryUse {
+  const char* name;
+  double bytes;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Solver
+////////////////////////////////////////////////////////////////////////////////
+//
+// A solver holds the particles, divided among the processes of a
+// communicator, and calculates the forces on them. Every process calculates
+// the forces on, and updates, its own slice [start(), end()). A replicated
+// solver keeps all particles on every process (e.g. to build a tree of
+// them); the others only keep each process' slice, so N is not limited by
+// the memory of one process. A step is:
+//   begin_step()  gets the particles updated by the other processes (as far
+//                 as this solver needs them), and e.g. builds the tree
+//   calc_forces() calculates the forces on the slice
+//   (the slice is updated by the integrator)
+//   end_step()    starts sending the updated slice to the other processes
+// Between begin_step() and calc_forces(), calc_diagnostics() may be called.
+// synchronize() completes the communication, so that all particles are
+// current on every process (if replicated).
+// Before begin_step(), reorder() may be called to sort the particles along
+// the Morton curve (see morton_sort), for locality: then the particles
+// close in the tree are close in memory, and each process' slice is a
+// spatially compact domain. A particle keeps its index.
+template <int D>
+struct Solver {
+  virtual ~Solver() = default;
+
+  virtual const char* name() const = 0;
+  // Initializes the particles from each process' slice [start(), end())
+  // (in the input order). Collective.
+  virtual void init(const Particle<D>* slice) = 0;
+  // Whether every process holds all particles
+  virtual bool replicated() const = 0;
+  // The particles held by this process: all particles (in the input order,
+  // until reordered) if replicated, otherwise the slice
+  virtual Particle<D>* particles() = 0;
+  virtual int num_particles() const = 0;
+  virtual int start() const = 0;
+  virtual int end() const = 0;
+  // This process' slice
+  Particle<D>* slice() { return particles() + (replicated() ? start() : 0); }
+  // Memory used by the solver's data structures on this process
+  virtual std::vector<MemoryUse> memory() const = 0;
+
+  // Chooses the solver's accuracy parameter (theta) for the target RMS
+  // relative force error. Returns false if it has none (exact solver).
+  // Collective.
+  virtual bool autotune(double error_target) {
+    (void)error_target;
+    return false;
+  }
+
+  // Sorts all particles along the Morton curve (completing communication
+  // first), if replicated. Collective.
+  virtual void reorder(Profile& profile) = 0;
+
+  virtual void begin_step(Profile& profile) = 0;
+  // Writes the forces on the slice: forces[i - start()] for i in the slice
+  virtual void calc_forces(Vec<double, D>* forces, Profile& profile) = 0;
+  // Diagnostics of the slice (collective for some solvers)
+  virtual PartialDiagnostics<D> calc_diagnostics(Profile& profile) = 0;
+  virtual void end_step(Profile& profile) = 0;
+  virtual void synchronize(Profile& profile) = 0;
+};
+
+// Returns the solver for the engine chosen by opts (-e, -n, -m, -w, -R) for
+// N particles in the region, with the force law chosen by opts (-F, -S, -c).
+// If reproducible (-R), the forces on each particle (and the diagnostics)
+// are summed in an order that doesn't depend on the number of processes, so
+// results are bitwise identical for any number of processes.
+// The solvers are templated on the force law (kernel), so this is the only
+// place where it is chosen at run time.
+template <int D>
+std::unique_ptr<Solver<D>> make_solver(const options_t& opts, MPI_Comm comm,
+                                       int N, const Region<double, D>& region);
+
+////////////////////////////////////////////////////////////////////////////////
+// Tree solver
+////////////////////////////////////////////////////////////////////////////////
+// Every process has all particles, and builds its own tree of them.
+//
+// Each process broadcasts its updated slice with a nonblocking MPI_Ibcast
+// (one per process, all posted in rank order). The tree for the next step
+// is built slice by slice, in rank order, as the broadcasts complete, so
+// insertion of slices that already arrived overlaps the transfer of the
+// remaining ones. Inserting in rank order keeps the insertion order (and so
+// the tree and its floating-point sums) identical to inserting the whole
+// particles vector front to back. MPI only progresses the broadcasts inside
+// MPI calls, so the outstanding ones are tested every PROGRESS_INTERVAL
+// insertions.
+// Forces are calculated with walks shared by groups of particles (walk.h).
+template <int D, typename Kernel>
+struct TreeSolver : Solver<D> {
+  MPI_Comm comm;
+  int rank;
+  int size;
+  const Region<double, D> region;
+  double theta;
+  GroupWalk<D, Kernel> walk;
+  std::vector<Particle<D>> all;
+  // Slice of each process: [starts[r], ends[r]), and its size in bytes
+  std::vector<int> starts;
+  std::vector<int> ends;
+  std::vector<int> counts;
+  std::vector<int> displacements; // Slice starts in bytes
+  Tree<D> tree;
+  MortonKeys sort_keys;              // Buffer of reorder()
+  double autotune_bytes;             // Temporary buffers of autotune()
+  std::vector<MPI_Request> requests; // Broadcasts of the slices (completed:
+                                     // MPI_REQUEST_NULL)
+  std::vector<int> completed;        // Indices output by MPI_Testsome
+  bool slices_pending;
+  std::vector<double> potentials;    // Of the slice, for diagnostics
+
+  TreeSolver(MPI_Comm comm, int N, const Region<double, D>& region,
+             double theta, const Kernel& kernel, int group_size,
+             bool reproducible);
+
+  const char* name() const override { return "tree"; }
+  void init(const Particle<D>* slice) override;
+  bool replicated() const override { return true; }
+  Particle<D>* particles() override { return all.data(); }
+  int num_particles() const override { return all.size(); }
+  int start() const override { return starts[rank]; }
+  int end() const override { return ends[rank]; }
+  std::vector<MemoryUse> memory() const override;
+  bool autotune(double error_target) override;
+  void reorder(Profile& profile) override;
+  void begin_step(Profile& profile) override;
+  void calc_forces(Vec<double, D>* forces, Profile& profile) override;
+  PartialDiagnostics<D> calc_diagnostics(Profile& profile) override;
+  void end_step(Profile& profile) override;
+  void synchronize(Profile& profile) override;
+
+  private:
+  // Tests (and so progresses) the outstanding broadcasts
+  void progress();
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Shared tree solver
+////////////////////////////////////////////////////////////////////////////////
+// Processes on a node share one particles array and one tree (see
+// shared.h). Each step, node leaders exchange the blocks updated by their
+// nodes, then each leader builds the tree for its node, and all processes
+// calculate forces for their slice and update it in place.
+template <int D, typename Kernel>
+struct SharedTreeSolver : Solver<D> {
+  const Region<double, D> region;
+  double theta;
+  GroupWalk<D, Kernel> walk;
+  SharedMemory<D> shared;
+  Tree<D> tree;          // In the shared window, built by the node leader
+  MortonKeys sort_keys;  // Buffer of reorder() (node leader only)
+  double autotune_bytes; // Temporary buffers of autotune()
+  bool exchange_pending; // Blocks updated since the last exchange
+  std::vector<double> potentials; // Of the slice, for diagnostics
+
+  SharedTreeSolver(MPI_Comm comm, int N, const Region<double, D>& region,
+                   double theta, const Kernel& kernel, int group_size,
+                   bool reproducible);
+
+  const char* name() const override { return "shared tree"; }
+  void init(const Particle<D>* slice) override;
+  bool replicated() const override { return true; }
+  Particle<D>* particles() override { return shared.particles; }
+  int num_particles() const override { return shared.N_particles; }
+  int start() const override { return shared.start; }
+  int end() const override { return shared.end; }
+  std::vector<MemoryUse> memory() const override;
+  bool autotune(double error_target) override;
+  void reorder(Profile& profile) override;
+  void begin_step(Profile& profile) override;
+  void calc_forces(Vec<double, D>* forces, Profile& profile) override;
+  PartialDiagnostics<D> calc_diagnostics(Profile& profile) override;
+  void end_step(Profile& profile) override;
+  void synchronize(Profile& profile) override;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Direct solver
+////////////////////////////////////////////////////////////////////////////////
+// Exact direct summation (see direct.h). Each process only holds and
+// updates its own slice; the slices needed to compute forces are passed
+// around the ring. Not replicated: the particles stay in the input order
+// (the ring visits all particles, so reordering gains no locality).
+// If reproducible, the slices are divided in whole tiles of TILE_SOURCES
+// particles, and summed in the global order (see DirectSum).
+template <int D, typename Kernel>
+struct DirectSolver : Solver<D> {
+  MPI_Comm comm;
+  int rank;
+  int size;
+  const Region<double, D> region;
+  int N_particles;
+  std::vector<Particle<D>> local; // This process' slice
+  std::vector<int> starts;
+  std::vector<int> ends;
+  DirectSum<D, Kernel> direct;
+  std::vector<double> potentials;
+
+  DirectSolver(MPI_Comm comm, int N, const Region<double, D>& region,
+               const Kernel& kernel, bool reproducible);
+
+  const char* name() const override { return "direct"; }
+  void init(const Particle<D>* slice) override;
+  bool replicated() const override { return false; }
+  Particle<D>* particles() override { return local.data(); }
+  int num_particles() const override { return N_particles; }
+  int start() const override { return starts[rank]; }
+  int end() const override { return ends[rank]; }
+  std::vector<MemoryUse> memory() const override;
+  void reorder(Profile&) override {}
+  void begin_step(Profile&) override {}
+  void calc_forces(Vec<double, D>* forces, Profile& profile) override;
+  PartialDiagnostics<D> calc_diagnostics(Profile& profile) override;
+  void end_step(Profile&) override {}
+  void synchronize(Profile&) override {}
+};
+
+#endif // _SOLVER_H
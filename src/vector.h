@@ -5,91 +5,122 @@
 #include <sstream>
 #include <string>
 
+// Vector with D components of type T.
+// Specialized for D = 2 (x, y) and D = 3 (x, y, z) so components can be
+// accessed by name, or by position with operator[] in dimension-generic code.
+template <typename T, int D>
+struct Vec;
+
 template <typename T>
-struct Vec2 {
+struct Vec<T, 2> {
   T x;
   T y;
 
-  Vec2() = default;
-  Vec2(T x, T y);
-  Vec2(const Vec2& v) = default;
-  Vec2& operator=(const Vec2& rhs);
+  Vec() = default;
+  Vec(T x, T y);
+  Vec(const Vec& v) = default;
+  Vec& operator=(const Vec& rhs) = default;
+
+  T& operator[](int i) { return (i == 0 ? x : y); }
+  const T& operator[](int i) const { return (i == 0 ? x : y); }
+
+  std::string toString() const;
+};
+
+template <typename T>
+struct Vec<T, 3> {
+  T x;
+  T y;
+  T z;
+
+  Vec() = default;
+  Vec(T x, T y, T z);
+  Vec(const Vec& v) = default;
+  Vec& operator=(const Vec& rhs) = default;
+
+  T& operator[](int i) { return (i == 0 ? x : (i == 1 ? y : z)); }
+  const T& operator[](int i) const { return (i == 0 ? x : (i == 1 ? y : z)); }
 
   std::string toString() const;
 };
 
+template <typename T>
+using Vec2 = Vec<T, 2>;
+
+template <typename T>
+using Vec3 = Vec<T, 3>;
+
 ////////////////////////////////////////////////////////////////////////////////
-// Constructors & Assignment
+// Constructors
 ////////////////////////////////////////////////////////////////////////////////
 template <typename T>
-Vec2<T>::Vec2(T x_in, T y_in) : x(x_in), y(y_in) {}
+Vec<T, 2>::Vec(T x_in, T y_in) : x(x_in), y(y_in) {}
 
 template <typename T>
-Vec2<T>& Vec2<T>::operator=(const Vec2& rhs) {
-  x = rhs.x;
-  y = rhs.y;
-  return *this;
-}
+Vec<T, 3>::Vec(T x_in, T y_in, T z_in) : x(x_in), y(y_in), z(z_in) {}
 
 ////////////////////////////////////////////////////////////////////////////////
 // String
 ////////////////////////////////////////////////////////////////////////////////
 template <typename T>
-std::string Vec2<T>::toString() const {
+std::string Vec<T, 2>::toString() const {
   std::stringstream ss;
   ss << "(" << x << ", " << y << ")";
   return ss.str();
 }
 
+template <typename T>
+std::string Vec<T, 3>::toString() const {
+  std::stringstream ss;
+  ss << "(" << x << ", " << y << ", " << z << ")";
+  return ss.str();
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 // Operations
 ////////////////////////////////////////////////////////////////////////////////
+// Loops over the D components are unrolled by the compiler.
 
 // Vector addition
-template <typename T>
-Vec2<T> operator+(const Vec2<T>& v1, const Vec2<T>& v2) {
-  return Vec2<T>{
-    v1.x + v2.x,
-    v1.y + v2.y
-  };
+template <typename T, int D>
+Vec<T, D> operator+(const Vec<T, D>& v1, const Vec<T, D>& v2) {
+  Vec<T, D> v;
+  for (int i = 0; i < D; ++i) { v[i] = v1[i] + v2[i]; }
+  return v;
 }
 
 // Vector subtraction
-template <typename T>
-Vec2<T> operator-(const Vec2<T>& v1, const Vec2<T>& v2) {
-  return Vec2<T>{
-    v1.x - v2.x,
-    v1.y - v2.y
-  };
+template <typename T, int D>
+Vec<T, D> operator-(const Vec<T, D>& v1, const Vec<T, D>& v2) {
+  Vec<T, D> v;
+  for (int i = 0; i < D; ++i) { v[i] = v1[i] - v2[i]; }
+  return v;
 }
 
 // Same Type
 // Right multiplication of vector v by scalar k: vk
-template <typename T>
-Vec2<T> operator*(const Vec2<T>& v, T k) {
-  return Vec2<T>{
-    v.x * k,
-    v.y * k
-  };
+template <typename T, int D>
+Vec<T, D> operator*(const Vec<T, D>& v, T k) {
+  Vec<T, D> w;
+  for (int i = 0; i < D; ++i) { w[i] = v[i] * k; }
+  return w;
 }
 
 // Same Type
 // Left multiplication of vector v by scalar k: kv
-template <typename T>
-Vec2<T> operator*(T k, const Vec2<T>& v) {
-  return Vec2<T>{
-    k * v.x,
-    k * v.y
-  };
+template <typename T, int D>
+Vec<T, D> operator*(T k, const Vec<T, D>& v) {
+  Vec<T, D> w;
+  for (int i = 0; i < D; ++i) { w[i] = k * v[i]; }
+  return w;
 }
 
 // Vector division by scalar: v/k
-template <typename T>
-Vec2<T> operator/(const Vec2<T>& v, T k) {
-  return Vec2<T>{
-    v.x/k,
-    v.y/k
-  };
+template <typename T, int D>
+Vec<T, D> operator/(const Vec<T, D>& v, T k) {
+  Vec<T, D> w;
+  for (int i = 0; i < D; ++i) { w[i] = v[i]/k; }
+  return w;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -97,34 +128,30 @@ Vec2<T> operator/(const Vec2<T>& v, T k) {
 ////////////////////////////////////////////////////////////////////////////////
 
 // Addition assign
-template <typename T>
-Vec2<T>& operator+=(Vec2<T>& v, const Vec2<T>& rhs) {
-  v.x += rhs.x;
-  v.y += rhs.y;
+template <typename T, int D>
+Vec<T, D>& operator+=(Vec<T, D>& v, const Vec<T, D>& rhs) {
+  for (int i = 0; i < D; ++i) { v[i] += rhs[i]; }
   return v;
 }
 
 // Subtraction assign
-template <typename T>
-Vec2<T>& operator-=(Vec2<T>&v, const Vec2<T>& rhs) {
-  v.x -= rhs.x;
-  v.y -= rhs.y;
+template <typename T, int D>
+Vec<T, D>& operator-=(Vec<T, D>& v, const Vec<T, D>& rhs) {
+  for (int i = 0; i < D; ++i) { v[i] -= rhs[i]; }
   return v;
 }
 
 // Multiplication assign (right multiply)
-template <typename T>
-Vec2<T>& operator*=(Vec2<T>&v, T k) {
-  v.x *= k;
-  v.y *= k;
+template <typename T, int D>
+Vec<T, D>& operator*=(Vec<T, D>& v, T k) {
+  for (int i = 0; i < D; ++i) { v[i] *= k; }
   return v;
 }
 
 // Division assign
-template <typename T>
-Vec2<T>& operator/=(Vec2<T>&v, T k) {
-  v.x /= k;
-  v.y /= k;
+template <typename T, int D>
+Vec<T, D>& operator/=(Vec<T, D>& v, T k) {
+  for (int i = 0; i < D; ++i) { v[i] /= k; }
   return v;
 }
 
@@ -133,14 +160,16 @@ Vec2<T>& operator/=(Vec2<T>&v, T k) {
 ////////////////////////////////////////////////////////////////////////////////
 // Compare
 ////////////////////////////////////////////////////////////////////////////////
-template <typename T>
-bool operator==(const Vec2<T>& v1, const Vec2<T>& v2) {
-  return v1.x == v2.x && 
-         v1.y == v2.y;
+template <typename T, int D>
+bool operator==(const Vec<T, D>& v1, const Vec<T, D>& v2) {
+  for (int i = 0; i < D; ++i) {
+    if (v1[i] != v2[i]) return false;
+  }
+  return true;
 }
 
-template <typename T>
-bool operator!=(const Vec2<T>& v1, const Vec2<T>& v2) {
+template <typename T, int D>
+bool operator!=(const Vec<T, D>& v1, const Vec<T, D>& v2) {
   return !(v1 == v2);
 }
 
@@ -149,38 +178,50 @@ bool operator!=(const Vec2<T>& v1, const Vec2<T>& v2) {
 ////////////////////////////////////////////////////////////////////////////////
 
 // Returns the dot product of vectors a and b
-template <typename T>
-T dot(const Vec2<T>& a, const Vec2<T>& b) {
-  return (a.x*b.x + a.y*b.y);
+// Equivalent to a.x*b.x + a.y*b.y (+ a.z*b.z)
+template <typename T, int D>
+T dot(const Vec<T, D>& a, const Vec<T, D>& b) {
+  T sum = a[0]*b[0];
+  for (int i = 1; i < D; ++i) { sum += a[i]*b[i]; }
+  return sum;
 }
 
 // Returns the squared length of vector v
-// Equivalent to v.x*v.x + v.y*v.y
-template <typename T>
-T len2(const Vec2<T>& v) {
+// Equivalent to v.x*v.x + v.y*v.y (+ v.z*v.z)
+template <typename T, int D>
+T len2(const Vec<T, D>& v) {
   return dot(v, v);
 }
 
 // Returns the length of vector v
-// Equivalent to √(v.x*v.x + v.y*v.y)
-template <typename T>
-T len(const Vec2<T>& v) {
+// Equivalent to √(v.x*v.x + v.y*v.y (+ v.z*v.z))
+template <typename T, int D>
+T len(const Vec<T, D>& v) {
   return std::sqrt(len2(v));
 }
 
 // Returns the squared distance between vectors a and b
-// Equivalent to (b.x - a.x)^2 + (b.y - a.y)^2
-template <typename T>
-T dist2(const Vec2<T>& a, const Vec2<T>& b) {
+// Equivalent to (b.x - a.x)^2 + (b.y - a.y)^2 (+ (b.z - a.z)^2)
+template <typename T, int D>
+T dist2(const Vec<T, D>& a, const Vec<T, D>& b) {
   return len2(b - a);
 }
 
 // Returns the distance between vectors a and b
-// Equivalent to √[(b.x - a.x)^2 + (b.y - a.y)^2]
-template <typename T>
-T dist(const Vec2<T>& a, const Vec2<T>& b) {
+// Equivalent to √[(b.x - a.x)^2 + (b.y - a.y)^2 (+ (b.z - a.z)^2)]
+template <typename T, int D>
+T dist(const Vec<T, D>& a, const Vec<T, D>& b) {
   return len(b - a);
 }
 
+// Returns whether all components of v are finite (not infinite or NaN)
+template <typename T, int D>
+bool isfinite(const Vec<T, D>& v) {
+  for (int i = 0; i < D; ++i) {
+    if (!std::isfinite(v[i])) return false;
+  }
+  return true;
+}
+
 
-#endif //_VECTOR_H
\ No newline at end of file
+#endif //_VECTOR_H
@@ -0,0 +1,159 @@
+#include "walk.h"
+#include "direct.h"
+#include <algorithm>
+
+template <int D, typename Kernel>
+GroupWalk<D, Kernel>::GroupWalk(const Kernel& k, int g, bool fixed)
+    : kernel(k),
+      group_size(std::max(g, 1)),
+      fixed_groups(fixed),
+      capacity(0),
+      length(0),
+      targets(D*group_size),
+      acc(D*group_size),
+      node_visits(0),
+      interactions(0),
+      particles_walked(0) {}
+
+template <int D, typename Kernel>
+void GroupWalk<D, Kernel>::calc_net_forces(const Particle<D>* particles,
+                                           int N, int start, int end,
+                                           const TreeNode<D>* nodes,
+                                           int num_nodes, double theta,
+                                           Vec<double, D>* forces) {
+  // Order the particles along the Morton curve (or by block, already in
+  // order). Lost particles receive no force.
+  order.clear();
+  for (int i = start; i < end; ++i) {
+    forces[i - start] = Vec<double, D>();
+    if (particles[i].mass == -1 || num_nodes == 0) continue;
+    uint64_t key = (fixed_groups ? i / group_size :
+                    morton_key(particles[i].position, nodes[0].region));
+    order.emplace_back(key, i);
+  }
+  if (!fixed_groups) { std::sort(order.begin(), order.end()); }
+  node_visits = 0;
+  interactions = 0;
+  particles_walked = order.size();
+
+  const int tc = group_size;
+  for (size_t first = 0, n = 0; first < order.size(); first += n) {
+    // Up to group_size particles (those of one block, with fixed groups)
+    n = std::min<size_t>(group_size, order.size() - first);
+    if (fixed_groups) {
+      n = 1;
+      while (first + n < order.size() &&
+             order[first + n].first == order[first].first) {
+        n++;
+      }
+    }
+    // Positions & bounding box of the group
+    Region<double, D> box;
+    box.min = box.max = particles[order[first].second].position;
+    for (size_t k = 0; k < n; ++k) {
+      const Vec<double, D>& r = particles[order[first + k].second].position;
+      for (int d = 0; d < D; ++d) {
+        box.min[d] = std::min(box.min[d], r[d]);
+        box.max[d] = std::max(box.max[d], r[d]);
+        targets[d*tc + k] = r[d];
+        acc[d*tc + k] = 0;
+      }
+    }
+    // A fixed group is bounded by all the particles of its block
+    if (fixed_groups) {
+      int block = order[first].first * group_size;
+      for (int i = block; i < std::min(block + group_size, N); ++i) {
+        if (particles[i].mass == -1) continue;
+        const Vec<double, D>& r = particles[i].position;
+        for (int d = 0; d < D; ++d) {
+          box.min[d] = std::min(box.min[d], r[d]);
+          box.max[d] = std::max(box.max[d], r[d]);
+        }
+      }
+    }
+
+    // One walk for the group, then sum over its interaction list
+    length = 0;
+    walk(nodes, 0, box, theta);
+    accumulate_direct<D>(targets.data(), n, tc, list.data(), capacity, length,
+                         kernel, acc.data());
+    interactions += (long long)length*n;
+
+    // Scale accelerations to forces
+    for (size_t k = 0; k < n; ++k) {
+      int i = order[first + k].second;
+      double m = particles[i].mass;
+      for (int d = 0; d < D; ++d) {
+        forces[i - start][d] = G*m*acc[d*tc + k];
+      }
+    }
+  }
+}
+
+template <int D, typename Kernel>
+double GroupWalk<D, Kernel>::bytes() const {
+  return (double)order.capacity()*sizeof(order[0]) +
+         (double)(list.capacity() + targets.capacity() + acc.capacity())*
+         sizeof(double);
+}
+
+template <int D, typename Kernel>
+void GroupWalk<D, Kernel>::walk(const TreeNode<D>* nodes, int node,
+                                const Region<double, D>& box, double theta) {
+  if (node == -1) {
+    return;
+  }
+  const TreeNode<D>* n = &nodes[node];
+  node_visits++;
+  // Nodes beyond the cutoff of the force law from the whole group exert no
+  // force on it
+  if constexpr (Kernel::HAS_CUTOFF) {
+    if (kernel.beyond(min_dist2(box, n->region))) return;
+  }
+  // A leaf's total mass & center of mass are its particle's mass & position
+  if (n->num_particles == 1) {
+    add(n->com, n->total_mass);
+    return;
+  }
+  // Accept the node for the whole group if s/d_min < theta
+  double s = n->region.side_length();
+  if (s*s < theta*theta*min_dist2(n->com, box)) {
+    add(n->com, n->total_mass);
+    return;
+  }
+  for (int c = 0; c < TreeNode<D>::NUM_CHILDREN; ++c) {
+    walk(nodes, n->children[c], box, theta);
+  }
+}
+
+template <int D, typename Kernel>
+void GroupWalk<D, Kernel>::add(const Vec<double, D>& position, double mass) {
+  if (length == capacity) {
+    // Grow the list, moving each coordinate's (and the masses') segment
+    int new_capacity = std::max(2*capacity, 256);
+    std::vector<double> grown((D + 1)*new_capacity);
+    for (int k = 0; k <= D; ++k) {
+      std::copy(list.begin() + k*capacity, list.begin() + k*capacity + length,
+                grown.begin() + k*new_capacity);
+    }
+    list.swap(grown);
+    capacity = new_capacity;
+  }
+  for (int k = 0; k < D; ++k) {
+    list[k*capacity + length] = position[k];
+  }
+  list[D*capacity + length] = mass;
+  length++;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Instantiations for 2D & 3D, and each kernel
+////////////////////////////////////////////////////////////////////////////////
+template struct GroupWalk<2, ClampKernel>;
+template struct GroupWalk<2, PlummerKernel>;
+template struct GroupWalk<2, SplineKernel>;
+template struct GroupWalk<2, CutoffKernel>;
+template struct GroupWalk<3, ClampKernel>;
+template struct GroupWalk<3, PlummerKernel>;
+template struct GroupWalk<3, SplineKernel>;
+template struct GroupWalk<3, CutoffKernel>;
@@ -0,0 +1,87 @@
+#ifndef _WALK_H
+#define _WALK_H
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+#include "kernels.h"
+#include "particle.h"
+#include "quadtree.h"
+#include "vector.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// Group walk (tree traversal shared by a group of particles)
+////////////////////////////////////////////////////////////////////////////////
+//
+// Neighboring particles open almost the same tree nodes, so instead of one
+// walk per particle, the particles of a slice
+// are sorted along the Morton curve and cut into groups of up to group_size
+// consecutive particles, and the tree is walked once per group. A node is
+// accepted (approximated by its center of mass) for the whole group if
+//   s/d_min < theta
+// where d_min is the distance from the node's center of mass to the group's
+// bounding box: a conservative test, which every particle of the group would
+// also pass on its own (d >= d_min). Otherwise the node is opened. The walk
+// produces an interaction list of the accepted nodes and leaf particles,
+// and the forces on the group's particles are then summed over the list in
+// a vectorized loop (accumulate_direct in direct.h). A particle's own leaf
+// is in its group's list, but contributes no force (r_j - r_i = 0).
+//
+// Forces are at least as accurate as with per-particle walks with the same
+// theta (some nodes are opened that a particle would have accepted), and
+// group_size = 1 walks the tree for each particle.
+//
+// With fixed groups (reproducible mode), the groups are instead the blocks
+// [k*group_size, (k + 1)*group_size) of the particles array, bounded by all
+// of their particles even if a block straddles two slices. A particle's
+// interaction list, and so its force, then doesn't depend on how the
+// particles are divided among processes. The groups are only compact while
+// the array is sorted along the Morton curve (see morton_sort).
+template <int D, typename Kernel>
+struct GroupWalk {
+  const Kernel kernel;
+  const int group_size;
+  const bool fixed_groups;
+
+  // Particles of the slice (not lost) with their Morton keys (block indices
+  // with fixed groups), in order
+  std::vector<std::pair<uint64_t, int>> order;
+  // Interaction list, laid out as the blocks of DirectSum:
+  // [x_0..x_cap-1 | y_0.. | (z_0.. |) m_0..m_cap-1]
+  std::vector<double> list;
+  int capacity;
+  int length;
+  // Targets (the group's positions) & accelerations, with group_size capacity
+  std::vector<double> targets;
+  std::vector<double> acc;
+
+  // Counters of the last calc_net_forces: nodes visited by the walks,
+  // particle-node interactions summed, and particles whose forces were
+  // calculated
+  long long node_visits;
+  long long interactions;
+  long long particles_walked;
+
+  GroupWalk(const Kernel& kernel, int group_size, bool fixed_groups = false);
+
+  // Calculates the net force on each particle of [start, end) of the N
+  // particles from all other particles in the tree nodes (root first, as
+  // stored by Tree), using the given value of theta as a threshold for
+  // approximations. Writes forces[i - start] (0 for lost particles).
+  void calc_net_forces(const Particle<D>* particles, int N, int start,
+                       int end, const TreeNode<D>* nodes, int num_nodes,
+                       double theta, Vec<double, D>* forces);
+
+  // Bytes allocated for the buffers
+  double bytes() const;
+
+  private:
+  // Walks the tree below node for the group with the bounding box,
+  // appending to the interaction list
+  void walk(const TreeNode<D>* nodes, int node, const Region<double, D>& box,
+            double theta);
+  // Appends a point mass to the interaction list
+  void add(const Vec<double, D>& position, double mass);
+};
+
+#endif // _WALK_H